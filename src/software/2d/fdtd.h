@@ -2,6 +2,7 @@
 #define FDTD_H_
 #include "../nob.h"
 #include <math.h>
+#include <pthread.h>
 
 typedef enum {
   OneDimension,
@@ -17,6 +18,8 @@ typedef struct {
   double imp0;
 } GridParameter;
 
+typedef struct BoundaryParam BoundaryParam;
+
 typedef struct {
   int time;
   double *hx, *chxh, *chxe;
@@ -27,18 +30,39 @@ typedef struct {
   double *ez, *ceze, *cezh;
   GridType type;
   GridParameter param;
+  BoundaryParam *wrap; // periodic halos, filled by updateH/updateE
 } Grid;
 
 typedef enum {
   ABC,
   PML,
   cPML,
+  Periodic,
 } BoundaryType;
 
-typedef struct {
+typedef struct AbcPool AbcPool;
+
+/*
+ * Second-order Mur ABC on the four edges of a TwoDimensionMagnetic grid.
+ * hist[edge][q][m] is the Ez history of edge left, right, bottom, top, q
+ * steps back (0 = last step) and m cells in from the edge, each one plane
+ * along the edge so the update runs down contiguous arrays. Set threads
+ * before boundary_init to run the edges concurrently.
+ *
+ * periodic/phase/pair/imaginary are further inputs: the flagged axes are
+ * wrapped instead of absorbed (Periodic absorbs nothing, and wraps both
+ * axes when none is flagged), see periodic_fill.
+ */
+struct BoundaryParam {
   double coef0, coef1, coef2;
-  double *ezLeft, *ezRight, *ezTop, *ezBottom;
-} BoundaryParam;
+  double *hist[4][2][3];
+  int threads; // > 1: edges on up to 4 threads
+  AbcPool *pool;
+  bool periodic[2]; // axes wrapped through halo planes
+  double phase[2];  // Bloch phase shift per period, radians
+  Grid *pair;       // Bloch: grid with the other part of the field
+  bool imaginary;   // Bloch: this grid holds the imaginary part
+};
 
 typedef struct {
   double coef;
@@ -93,8 +117,10 @@ typedef struct {
     (p) = NULL;                                                                \
   } while (0)
 
-#define IDX2(M, N, WIDTH) ((M) * (WIDTH) + (N))
-#define IDX3(M, N, P, COL, ROW) ((((M) * (COL) + (N)) * (ROW) + (P)))
+// Flat array offsets, formed in size_t so grids beyond 2^31 cells work.
+#define IDX2(M, N, WIDTH) ((size_t)(M) * (size_t)(WIDTH) + (size_t)(N))
+#define IDX3(M, N, P, COL, ROW)                                                \
+  (((size_t)(M) * (size_t)(COL) + (size_t)(N)) * (size_t)(ROW) + (size_t)(P))
 
 void updateH(Grid *grid);
 void updateE(Grid *grid);
@@ -104,8 +130,9 @@ bool grid_free(Grid *g);
 
 bool grid_init_lossy(Grid *grid, int nLoss, float maxLoss);
 
-void boundary_init(Grid *grid, BoundaryType type, BoundaryParam *param);
+bool boundary_init(Grid *grid, BoundaryType type, BoundaryParam *param);
 void boundary_abc(Grid *grid, BoundaryParam *param);
+void boundary_free(BoundaryParam *param);
 void boundary_init_3d(Grid *grid, BoundaryType type, BoundaryParam3d *param);
 void boundary_abc_3d(Grid *grid, BoundaryParam3d *param);
 
@@ -168,6 +195,7 @@ bool grid_free(Grid *g) {
 
   g->time = 0;
   g->type = OneDimension;
+  g->wrap = NULL;
   memset(&g->param, 0, sizeof(g->param));
 
   return true;
@@ -183,6 +211,7 @@ bool grid_init(Grid *grid, GridType type, GridParameter param) {
   grid->type = type;
   grid->param = p;
   grid->time = 0;
+  grid->wrap = NULL;
 
   size_t sx = (size_t)p.sizeX;
   size_t sy = (size_t)p.sizeY;
@@ -285,6 +314,129 @@ overflow:
   return false;
 }
 
+/*
+ * Periodic and Bloch-periodic axes of a TwoDimensionMagnetic grid, wrapped
+ * through one halo line per side: on an axis of n cells index 0 is the
+ * image of n - 2 and index n - 1 that of 1, so the period is n - 2 cells.
+ * Hy along x and Hx along y sit at half cells and only have the low halo.
+ * The update loops run as usual, and at the start of updateH (for Ez) and
+ * updateE (for Hx, Hy) the halos are overwritten from their images.
+ *
+ * A Bloch phase makes the field complex: real and imaginary parts are two
+ * grids, each with a BoundaryParam naming the other as `pair`, and an image
+ * k periods away is rotated by k * phase. Step them in lockstep, updateH on
+ * both before updateE on either.
+ */
+typedef struct {
+  double *f;       // component
+  const double *g; // the pair's part of it, or NULL
+  size_t width;
+} HaloField;
+
+// Image of index i on a periodic axis of n cells; *k counts periods crossed.
+static inline int _halo_image(int i, int n, int *k) {
+  if (i == 0) {
+    *k -= 1;
+    return n - 2;
+  }
+  if (i == n - 1) {
+    *k += 1;
+    return 1;
+  }
+  return i;
+}
+
+static inline void _halo_at(const BoundaryParam *param, HaloField h,
+                            const Grid *grid, const double rot[9][2], int mm,
+                            int nn) {
+  int kx = 0, ky = 0;
+  int m1 = param->periodic[0] ? _halo_image(mm, grid->param.sizeX, &kx) : mm;
+  int n1 = param->periodic[1] ? _halo_image(nn, grid->param.sizeY, &ky) : nn;
+  const double *r = rot[(kx + 1) * 3 + ky + 1];
+  size_t d = IDX2(mm, nn, h.width), s = IDX2(m1, n1, h.width);
+
+  h.f[d] = h.g ? r[0] * h.f[s] + r[1] * h.g[s] : r[0] * h.f[s];
+}
+
+// Halo cells of one component of nx x ny cells.
+static void _halo_lines(const Grid *grid, HaloField h, int nx, int ny,
+                        const double rot[9][2]) {
+  const BoundaryParam *param = grid->wrap;
+  int X = grid->param.sizeX, Y = grid->param.sizeY;
+
+  for (int mm = 0; mm < nx; mm++) {
+    if (param->periodic[0] && (mm == 0 || mm == X - 1)) {
+      for (int nn = 0; nn < ny; nn++)
+        _halo_at(param, h, grid, rot, mm, nn);
+    } else if (param->periodic[1]) {
+      _halo_at(param, h, grid, rot, mm, 0);
+      if (ny == Y)
+        _halo_at(param, h, grid, rot, mm, Y - 1);
+    }
+  }
+}
+
+static void periodic_fill(Grid *grid, bool magnetic) {
+  const BoundaryParam *param = grid->wrap;
+  const Grid *q = param->pair;
+  int X = grid->param.sizeX, Y = grid->param.sizeY;
+  double rot[9][2];
+
+  // Rotation for (kx, ky) periods at (kx + 1) * 3 + ky + 1.
+  for (int r = 0; r < 9; r++) {
+    double t = (r / 3 - 1) * param->phase[0] + (r % 3 - 1) * param->phase[1];
+    rot[r][0] = cos(t);
+    rot[r][1] = param->imaginary ? sin(t) : -sin(t);
+  }
+
+  if (!magnetic) {
+    _halo_lines(grid, (HaloField){grid->ez, q ? q->ez : NULL, Y}, X, Y, rot);
+    return;
+  }
+  _halo_lines(grid, (HaloField){grid->hx, q ? q->hx : NULL, Y - 1}, X, Y - 1,
+              rot);
+  _halo_lines(grid, (HaloField){grid->hy, q ? q->hy : NULL, Y}, X - 1, Y,
+              rot);
+}
+
+static bool periodic_init(Grid *grid, BoundaryType type,
+                          BoundaryParam *param) {
+  int N[2] = {grid->param.sizeX, grid->param.sizeY};
+  bool any = param->periodic[0] || param->periodic[1];
+
+  if (type == Periodic && !any)
+    param->periodic[0] = param->periodic[1] = any = true;
+  if (!any)
+    return true;
+  if (grid->type != TwoDimensionMagnetic) {
+    fprintf(stderr, "[boundary_init] periodic axes need a TMz grid\n");
+    return false;
+  }
+
+  for (int ax = 0; ax < 2; ax++) {
+    if (!param->periodic[ax])
+      continue;
+    if (N[ax] < 3) {
+      fprintf(stderr, "[boundary_init] periodic axis %d needs 3 cells\n", ax);
+      return false;
+    }
+    if (!param->pair && fabs(sin(param->phase[ax])) > 1e-12) {
+      fprintf(stderr, "[boundary_init] Bloch phase needs a pair grid\n");
+      return false;
+    }
+  }
+
+  Grid *q = param->pair;
+  if (q && (q->type != grid->type || q->param.sizeX != N[0] ||
+            q->param.sizeY != N[1])) {
+    fprintf(stderr, "[boundary_init] pair grid has a different shape\n");
+    return false;
+  }
+
+  grid->wrap = param;
+  return true;
+}
+
 void updateH(Grid *grid) {
   int mm, nn, pp;
   switch (grid->type) {
@@ -296,6 +448,8 @@ void updateH(Grid *grid) {
     return;
 
   case TwoDimensionMagnetic:
+    if (grid->wrap)
+      periodic_fill(grid, false);
     for (mm = 0; mm < grid->param.sizeX; mm++) {
       for (nn = 0; nn < (grid->param.sizeY - 1); nn++) {
         grid->hx[IDX2(mm, nn, (grid->param.sizeY - 1))] =
@@ -420,6 +574,8 @@ void updateE(Grid *grid) {
     }
     return;
   case TwoDimensionMagnetic:
+    if (grid->wrap)
+      periodic_fill(grid, true);
     for (mm = 1; mm < (grid->param.sizeX - 1); mm++) {
       for (nn = 1; nn < (grid->param.sizeY - 1); nn++) {
         grid->ez[IDX2(mm, nn, grid->param.sizeY)] =
@@ -532,6 +688,214 @@ void updateE(Grid *grid) {
   }
 }
 
+enum { AbcLeft, AbcRight, AbcBottom, AbcTop };
+
+// One edge of Ez: the edge cell at edge index 0, the two cells inward from
+// it, and the step between neighbouring cells along the edge.
+typedef struct {
+  double *f0;
+  const double *f1, *f2;
+  size_t step;
+  int len;
+} AbcEdge;
+
+typedef struct {
+  AbcPool *pool;
+  int id;
+} AbcWorker;
+
+struct AbcPool {
+  pthread_t threads[4];
+  AbcWorker workers[4];
+  pthread_barrier_t start, done;
+  int count;
+  bool quit;
+  Grid *grid;
+  BoundaryParam *param;
+};
+
+static AbcEdge _abc_edge(Grid *grid, int edge) {
+  size_t X = (size_t)grid->param.sizeX, Y = (size_t)grid->param.sizeY;
+  double *ez = grid->ez;
+
+  switch (edge) {
+  case AbcLeft:
+    return (AbcEdge){ez, ez + Y, ez + 2 * Y, 1, (int)Y};
+  case AbcRight:
+    return (AbcEdge){ez + (X - 1) * Y, ez + (X - 2) * Y, ez + (X - 3) * Y, 1,
+                     (int)Y};
+  case AbcBottom:
+    return (AbcEdge){ez, ez + 1, ez + 2, Y, (int)X};
+  default:
+    return (AbcEdge){ez + Y - 1, ez + Y - 2, ez + Y - 3, Y, (int)X};
+  }
+}
+
+/*
+ * Advances cells [lo, hi) of an edge. The older history level is read and
+ * then overwritten in place with the cells as they are now, so once every
+ * part of the edge is done boundary_abc only swaps the two levels. Left and
+ * right edges are contiguous in Ez and get their own (vectorized) copy of
+ * the loop with a unit step.
+ */
+static inline void _abc_cells(double *restrict f0, const double *restrict f1,
+                              const double *restrict f2,
+                              const double *restrict o0,
+                              const double *restrict o1,
+                              const double *restrict o2, double *restrict p0,
+                              double *restrict p1, double *restrict p2,
+                              const double c[3], size_t step, int lo, int hi) {
+  double c0 = c[0], c1 = c[1], c2 = c[2];
+
+  for (int i = lo; i < hi; i++) {
+    size_t k = (size_t)i * step;
+    double v = c0 * (f2[k] + p0[i]) + c1 * (o0[i] + o2[i] - f1[k] - p1[i]) +
+               c2 * o1[i] - p2[i];
+    f0[k] = v;
+    p0[i] = v;
+    p1[i] = f1[k];
+    p2[i] = f2[k];
+  }
+}
+
+static void _abc_run(Grid *grid, BoundaryParam *param, int edge, int lo,
+                     int hi) {
+  if (!param->hist[edge][0][0])
+    return;
+
+  AbcEdge g = _abc_edge(grid, edge);
+  double **o = param->hist[edge][0], **p = param->hist[edge][1];
+  double c[3] = {param->coef0, param->coef1, param->coef2};
+
+  if (g.step == 1)
+    _abc_cells(g.f0, g.f1, g.f2, o[0], o[1], o[2], p[0], p[1], p[2], c, 1, lo,
+               hi);
+  else
+    _abc_cells(g.f0, g.f1, g.f2, o[0], o[1], o[2], p[0], p[1], p[2], c,
+               g.step, lo, hi);
+}
+
+/*
+ * Cells within three of a corner are read or written by both edges meeting
+ * there, so the threads only take [3, len - 3) of their edges; boundary_abc
+ * finishes the corners afterwards in the serial edge order, which keeps the
+ * result identical to the unthreaded update.
+ */
+static void _abc_edges(AbcPool *pool, int worker) {
+  for (int e = worker; e < 4; e += pool->count)
+    _abc_run(pool->grid, pool->param, e, 3, _abc_edge(pool->grid, e).len - 3);
+}
+
+static void *_abc_worker(void *arg) {
+  AbcWorker *w = (AbcWorker *)arg;
+  AbcPool *pool = w->pool;
+
+  for (;;) {
+    pthread_barrier_wait(&pool->start);
+    if (pool->quit)
+      return NULL;
+    _abc_edges(pool, w->id);
+    pthread_barrier_wait(&pool->done);
+  }
+}
+
+// False, with param cleared, when the periodic inputs are rejected.
+bool boundary_init(Grid *grid, BoundaryType type, BoundaryParam *param) {
+  BoundaryParam in = *param;
+  int threads = in.threads;
+
+  memset(param, 0, sizeof(*param));
+  param->threads = threads;
+  param->pair = in.pair;
+  param->imaginary = in.imaginary;
+  memcpy(param->periodic, in.periodic, sizeof(in.periodic));
+  memcpy(param->phase, in.phase, sizeof(in.phase));
+  if (!periodic_init(grid, type, param))
+    return false;
+  if (type == Periodic)
+    return true;
+
+  // Edges across a periodic axis have no history and are skipped.
+  for (int e = 0; e < 4; e++)
+    for (int q = 0; q < 2 && !param->periodic[e / 2]; q++)
+      for (int m = 0; m < 3; m++) {
+        CALLOC(param->hist[e][q][m], double, _abc_edge(grid, e).len);
+      }
+
+  double temp1 = sqrt(grid->cezh[0] * grid->chye[0]);
+  double temp2 = 1.0 / temp1 + 2.0 + temp1;
+  param->coef0 = -(1.0 / temp1 - 2.0 + temp1) / temp2;
+  param->coef1 = -2.0 * (temp1 - 1.0 / temp1) / temp2;
+  param->coef2 = 4.0 * (temp1 + 1.0 / temp1) / temp2;
+
+  // Edges shorter than the two corner strips have nothing to share out.
+  int count = threads < 4 ? threads : 4;
+  if (count < 2 || grid->param.sizeX < 6 || grid->param.sizeY < 6)
+    return true;
+
+  AbcPool *pool;
+  CALLOC(pool, AbcPool, 1);
+  pool->count = count;
+  pool->param = param;
+  pthread_barrier_init(&pool->start, NULL, (unsigned)count);
+  pthread_barrier_init(&pool->done, NULL, (unsigned)count);
+  for (int i = 1; i < count; i++) {
+    pool->workers[i] = (AbcWorker){.pool = pool, .id = i};
+    if (pthread_create(&pool->threads[i], NULL, _abc_worker,
+                       &pool->workers[i]) != 0) {
+      fprintf(stderr, "[boundary_init] pthread_create failed\n");
+      abort();
+    }
+  }
+  param->pool = pool;
+  return true;
+}
+
+void boundary_abc(Grid *grid, BoundaryParam *param) {
+  AbcPool *pool = param->pool;
+
+  if (!pool) {
+    for (int e = 0; e < 4; e++)
+      _abc_run(grid, param, e, 0, _abc_edge(grid, e).len);
+  } else {
+    pool->grid = grid;
+    pthread_barrier_wait(&pool->start);
+    _abc_edges(pool, 0);
+    pthread_barrier_wait(&pool->done);
+    for (int e = 0; e < 4; e++) {
+      int len = _abc_edge(grid, e).len;
+      _abc_run(grid, param, e, 0, 3);
+      _abc_run(grid, param, e, len - 3, len);
+    }
+  }
+
+  // The level just written becomes the newest one.
+  for (int e = 0; e < 4; e++)
+    for (int m = 0; m < 3; m++) {
+      double *t = param->hist[e][0][m];
+      param->hist[e][0][m] = param->hist[e][1][m];
+      param->hist[e][1][m] = t;
+    }
+}
+
+void boundary_free(BoundaryParam *param) {
+  AbcPool *pool = param->pool;
+
+  if (pool) {
+    pool->quit = true;
+    pthread_barrier_wait(&pool->start);
+    for (int i = 1; i < pool->count; i++)
+      pthread_join(pool->threads[i], NULL);
+    pthread_barrier_destroy(&pool->start);
+    pthread_barrier_destroy(&pool->done);
+    FREE(param->pool);
+  }
+  for (int e = 0; e < 4; e++)
+    for (int q = 0; q < 2; q++)
+      for (int m = 0; m < 3; m++)
+        FREE(param->hist[e][q][m]);
+}
+
 void snapshotGrid(Grid *grid, Snapshot *snap) {
   int mm, nn;
   float dim, temp;
@@ -13,116 +13,6 @@ double ez_source(Grid *grid, double time, double location, int ppw) {
   return (1.0 - 2.0 * arg) * exp(-arg);
 }
 
-void boundary_init(Grid *grid, BoundaryType type, BoundaryParam *param) {
-  (void)type;
-  CALLOC(param->ezLeft, double, grid->param.sizeY * 6);
-  CALLOC(param->ezRight, double, grid->param.sizeY * 6);
-  CALLOC(param->ezTop, double, grid->param.sizeX * 6);
-  CALLOC(param->ezBottom, double, grid->param.sizeX * 6);
-
-  double temp1 = sqrt(grid->cezh[0] * grid->chye[0]);
-  double temp2 = 1.0 / temp1 + 2.0 + temp1;
-  param->coef0 = -(1.0 / temp1 - 2.0 + temp1) / temp2;
-  param->coef1 = -2.0 * (temp1 - 1.0 / temp1) / temp2;
-  param->coef2 = 4.0 * (temp1 + 1.0 / temp1) / temp2;
-
-  return;
-}
-
-void boundary_abc(Grid *grid, BoundaryParam *param) {
-  int mm, nn;
-
-#define SIZEY grid->param.sizeY
-#define SIZEX grid->param.sizeX
-
-#define IDX_ABC_LR(m, q, n) (((n) * 6) + ((q) * 3) + (m))
-#define IDX_ABC_TB(m, q, n) (((m) * 6) + ((q) * 3) + (n))
-
-  /* left */
-  for (nn = 0; nn < SIZEY; nn++) {
-    grid->ez[IDX2(0, nn, SIZEY)] =
-        param->coef0 * (grid->ez[IDX2(2, nn, SIZEY)] +
-                        param->ezLeft[IDX_ABC_LR(0, 1, nn)]) +
-        param->coef1 * (param->ezLeft[IDX_ABC_LR(0, 0, nn)] +
-                        param->ezLeft[IDX_ABC_LR(2, 0, nn)] -
-                        grid->ez[IDX2(1, nn, SIZEY)] -
-                        param->ezLeft[IDX_ABC_LR(1, 1, nn)]) +
-        param->coef2 * param->ezLeft[IDX_ABC_LR(1, 0, nn)] -
-        param->ezLeft[IDX_ABC_LR(2, 1, nn)];
-
-    for (mm = 0; mm < 3; mm++) {
-      param->ezLeft[IDX_ABC_LR(mm, 1, nn)] =
-          param->ezLeft[IDX_ABC_LR(mm, 0, nn)];
-      param->ezLeft[IDX_ABC_LR(mm, 0, nn)] = grid->ez[IDX2(mm, nn, SIZEY)];
-    }
-  }
-
-  /* right */
-  for (nn = 0; nn < SIZEY; nn++) {
-    grid->ez[IDX2(SIZEX - 1, nn, SIZEY)] =
-        param->coef0 * (grid->ez[IDX2(SIZEX - 3, nn, SIZEY)] +
-                        param->ezRight[IDX_ABC_LR(0, 1, nn)]) +
-        param->coef1 * (param->ezRight[IDX_ABC_LR(0, 0, nn)] +
-                        param->ezRight[IDX_ABC_LR(2, 0, nn)] -
-                        grid->ez[IDX2(SIZEX - 2, nn, SIZEY)] -
-                        param->ezRight[IDX_ABC_LR(1, 1, nn)]) +
-        param->coef2 * param->ezRight[IDX_ABC_LR(1, 0, nn)] -
-        param->ezRight[IDX_ABC_LR(2, 1, nn)];
-
-    for (mm = 0; mm < 3; mm++) {
-      param->ezRight[IDX_ABC_LR(mm, 1, nn)] =
-          param->ezRight[IDX_ABC_LR(mm, 0, nn)];
-      param->ezRight[IDX_ABC_LR(mm, 0, nn)] =
-          grid->ez[IDX2(SIZEX - 1 - mm, nn, SIZEY)];
-    }
-  }
-
-  /* bottom */
-  for (mm = 0; mm < SIZEX; mm++) {
-    grid->ez[IDX2(mm, 0, SIZEY)] =
-        param->coef0 * (grid->ez[IDX2(mm, 2, SIZEY)] +
-                        param->ezBottom[IDX_ABC_TB(mm, 1, 0)]) +
-        param->coef1 * (param->ezBottom[IDX_ABC_TB(mm, 0, 0)] +
-                        param->ezBottom[IDX_ABC_TB(mm, 0, 2)] -
-                        grid->ez[IDX2(mm, 1, SIZEY)] -
-                        param->ezBottom[IDX_ABC_TB(mm, 1, 1)]) +
-        param->coef2 * param->ezBottom[IDX_ABC_TB(mm, 0, 1)] -
-        param->ezBottom[IDX_ABC_TB(mm, 1, 2)];
-
-    for (nn = 0; nn < 3; nn++) {
-      param->ezBottom[IDX_ABC_TB(mm, 1, nn)] =
-          param->ezBottom[IDX_ABC_TB(mm, 0, nn)];
-      param->ezBottom[IDX_ABC_TB(mm, 0, nn)] = grid->ez[IDX2(mm, nn, SIZEY)];
-    }
-  }
-
-  /* top */
-  for (mm = 0; mm < SIZEX; mm++) {
-    grid->ez[IDX2(mm, SIZEY - 1, SIZEY)] =
-        param->coef0 * (grid->ez[IDX2(mm, SIZEY - 3, SIZEY)] +
-                        param->ezTop[IDX_ABC_TB(mm, 1, 0)]) +
-        param->coef1 * (param->ezTop[IDX_ABC_TB(mm, 0, 0)] +
-                        param->ezTop[IDX_ABC_TB(mm, 0, 2)] -
-                        grid->ez[IDX2(mm, SIZEY - 2, SIZEY)] -
-                        param->ezTop[IDX_ABC_TB(mm, 1, 1)]) +
-        param->coef2 * param->ezTop[IDX_ABC_TB(mm, 0, 1)] -
-        param->ezTop[IDX_ABC_TB(mm, 1, 2)];
-
-    for (nn = 0; nn < 3; nn++) {
-      param->ezTop[IDX_ABC_TB(mm, 1, nn)] = param->ezTop[IDX_ABC_TB(mm, 0, nn)];
-      param->ezTop[IDX_ABC_TB(mm, 0, nn)] =
-          grid->ez[IDX2(mm, SIZEY - 1 - nn, SIZEY)];
-    }
-  }
-
-#undef IDX_ABC_LR
-#undef IDX_ABC_TB
-#undef SIZEY
-#undef SIZEX
-
-  return;
-}
-
 bool grid_init_lossy(Grid *grid, int nLoss, float maxLoss) {
   double depthInLayer, lossFactor;
   int mm;
@@ -251,7 +141,8 @@ int main() {
   printf("path: %s/%s\n", s.filename, s.basename);
   printf("-----------------------------------------------\n");
 
-  boundary_init(g, ABC, p);
+  if (!boundary_init(g, ABC, p))
+    return EXIT_FAILURE;
 
   int mm = 20;
   for (int nn = 20; nn < g->param.sizeY - 20; nn++) {
@@ -270,6 +161,7 @@ int main() {
     snapshotGrid(g, &s);
   }
 
+  boundary_free(p);
   grid_free(g);
   free(g);
   free(p);
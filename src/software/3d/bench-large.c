@@ -0,0 +1,174 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#define FDTD_IMPLEMENTATION
+#include "fdtd.h"
+#define NOB_IMPLEMENTATION
+#include "../../../nob.h"
+
+/*
+ * Correctness past 2^31 cells.
+ *
+ *   cc -O2 -march=native bench-large.c -lm -lpthread
+ *   ./bench-large [size] [steps] [threads]
+ *
+ * A uniform size^3 grid (1300^3 by default, over 100 GB in double and half
+ * that with -DFDTD_FLOAT) first has IDX3/IDX2 of its last cell, past
+ * INT_MAX, checked from its own extents and strides; build with
+ * -fsanitize=undefined to have any overflow in them reported as well. It
+ * is then stepped with a point source next to its high x wall, where the
+ * flat offsets are largest, and compared bit for bit against a small grid
+ * that has the same source the same distance from every wall. Until a wall
+ * is reached the two see exactly the same update, so any difference is an
+ * indexing error. The grid is refused up front if it needs more than the
+ * physical memory, rather than being killed half way through first touch.
+ */
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * IDX3 of the last cell from the grid's own int extents and size_t strides,
+ * as the sweeps form it, against the same sum in 64 bits; with contiguous
+ * x rows also IDX2 over rows of sy samples, as the face loops use it.
+ */
+static bool check_offsets(const Grid *grid) {
+  int      X = grid->param.sizeX, Y = grid->param.sizeY;
+  int      Z = grid->param.sizeZ;
+  uint64_t want = (uint64_t)(X - 1) * grid->sx +
+                  (uint64_t)(Y - 1) * grid->sy + (uint64_t)(Z - 1);
+  bool     ok   = true;
+
+  if (IDX3(X - 1, Y - 1, Z - 1, grid->sx, grid->sy) != want) {
+    fprintf(stderr, "IDX3 at %d^3: %zu, want %llu\n", X,
+            IDX3(X - 1, Y - 1, Z - 1, grid->sx, grid->sy),
+            (unsigned long long)want);
+    ok = false;
+  }
+  if (grid->sx == (size_t)Y * grid->sy &&
+      IDX2((X - 1) * Y + (Y - 1), Z - 1, grid->sy) != want) {
+    fprintf(stderr, "IDX2 at %d^3: %zu, want %llu\n", X,
+            IDX2((X - 1) * Y + (Y - 1), Z - 1, grid->sy),
+            (unsigned long long)want);
+    ok = false;
+  }
+  return ok;
+}
+
+static bool fits_memory(int size) {
+  // Six fields, no coefficient arrays, rows padded by at most a few lines.
+  double bytes = 6.0 * size * size * (size + 64.0) * sizeof(Real);
+
+#ifdef __linux__
+  double phys = (double)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
+  if (phys > 0 && bytes > phys) {
+    fprintf(stderr,
+            "[ERROR] a %d^3 grid needs about %.0f GB, this node has %.0f GB\n",
+            size, bytes * 1e-9, phys * 1e-9);
+    return false;
+  }
+#endif
+  fprintf(stderr, "grid %d^3, about %.0f GB\n", size, bytes * 1e-9);
+  return true;
+}
+
+static double source(int time) {
+  double arg = (time - 10.0) / 4.0;
+  return exp(-arg * arg);
+}
+
+// Steps grid with the source at (sm, sn, sp) after every E update.
+static void run(Grid *grid, int steps, int sm, int sn, int sp) {
+  for (grid->time = 0; grid->time < steps; grid->time++) {
+    updateH(grid);
+    updateE(grid);
+    grid->ez[IDX3(sm, sn, sp, grid->sx, grid->sy)] += source(grid->time);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  int size    = argc > 1 ? atoi(argv[1]) : 1300;
+  int steps   = argc > 2 ? atoi(argv[2]) : 20;
+  int threads = argc > 3 ? atoi(argv[3]) : 1;
+  int reach   = steps + 3; // source to wall, beyond anything steps can reach
+  int small   = 2 * reach + 1;
+
+  if (size < small) {
+    fprintf(stderr, "[ERROR] size must be at least %d for %d steps\n", small,
+            steps);
+    return EXIT_FAILURE;
+  }
+  if (!fits_memory(size))
+    return EXIT_FAILURE;
+
+  GridParameter param = {
+      .sizeX   = size,
+      .sizeY   = size,
+      .sizeZ   = size,
+      .maxTime = steps,
+      .cdtds   = 1.0 / sqrt(3.0),
+      .imp0    = 377.0,
+      .threads = threads,
+      .uniform = true,
+  };
+  Grid big = {0}, ref = {0};
+
+  double t0 = now();
+  if (!grid_init(&big, ThreeDimension, param)) {
+    fprintf(stderr, "[ERROR] grid_init failed for the %d^3 grid\n", size);
+    return EXIT_FAILURE;
+  }
+  double t1 = now();
+  if (!check_offsets(&big)) {
+    fprintf(stderr, "[ERROR] flat offsets overflow\n");
+    return EXIT_FAILURE;
+  }
+  param.sizeX = param.sizeY = param.sizeZ = small;
+  param.threads                           = 1;
+  if (!grid_init(&ref, ThreeDimension, param)) {
+    fprintf(stderr, "[ERROR] grid_init failed for the reference grid\n");
+    return EXIT_FAILURE;
+  }
+
+  // Source `reach` cells from the high x wall and centred across.
+  int m0 = size - 1 - 2 * reach, n0 = size / 2 - reach, p0 = size / 2 - reach;
+  run(&big, steps, m0 + reach, n0 + reach, p0 + reach);
+  double t2 = now();
+  run(&ref, steps, reach, reach, reach);
+
+  Real  *a[6] = {big.ex, big.ey, big.ez, big.hx, big.hy, big.hz};
+  Real  *b[6] = {ref.ex, ref.ey, ref.ez, ref.hx, ref.hy, ref.hz};
+  size_t diffs = 0, last = 0;
+  double peak  = 0.0;
+
+  for (int c = 0; c < 6; c++)
+    for (int mm = 0; mm < small; mm++)
+      for (int nn = 0; nn < small; nn++)
+        for (int pp = 0; pp < small; pp++) {
+          size_t i = IDX3(m0 + mm, n0 + nn, p0 + pp, big.sx, big.sy);
+          Real   v = b[c][IDX3(mm, nn, pp, ref.sx, ref.sy)];
+
+          diffs += a[c][i] != v;
+          last = i > last ? i : last;
+          peak = fabs((double)v) > peak ? fabs((double)v) : peak;
+        }
+  // Nothing may have landed at the far corner either.
+  diffs += big.ez[IDX3(1, 1, 1, big.sx, big.sy)] != 0;
+
+  fprintf(stderr, "init %.1f s, %d steps %.1f s (%.2f s/step)\n", t1 - t0,
+          steps, t2 - t1, (t2 - t1) / steps);
+  fprintf(stderr, "largest offset compared %zu, peak |field| %g\n", last,
+          peak);
+  bool ok = diffs == 0 && peak > 0.0;
+  fprintf(stderr, "%s: %zu samples differ from the reference\n",
+          ok ? "ok" : "FAIL", diffs);
+
+  grid_free(&ref);
+  grid_free(&big);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,187 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#define FDTD_IMPLEMENTATION
+#include "fdtd.h"
+#define NOB_IMPLEMENTATION
+#include "../../../nob.h"
+
+/*
+ * Accuracy of the configured precision against a double reference.
+ *
+ *   cc -O2 bench-precision.c -lm                 (double, sanity check)
+ *   cc -O2 -DFDTD_FLOAT bench-precision.c -lm
+ *   cc -O2 -DFDTD_MIXED bench-precision.c -lm
+ *   ./bench-precision [size] [steps] > /dev/null
+ *
+ * The grid is stepped with the regular engine in whatever Real/Accum the
+ * header was built with, and next to it with a plain double implementation
+ * of the same free-space Yee update. At a few checkpoints the table (on
+ * stderr) shows the largest pointwise Ez error relative to the peak of the
+ * reference, the relative L2 error over all six components, and the
+ * relative error of the total field energy sum(E^2) + imp0^2 sum(H^2).
+ */
+
+typedef struct {
+  double *ex, *ey, *ez;
+  double *hx, *hy, *hz;
+} RefGrid;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double source(int time) {
+  double arg = (time - 30.0) / 10.0;
+  return exp(-arg * arg) * sin(0.3 * time);
+}
+
+static void ref_step(RefGrid *r, int X, int Y, int Z, size_t sx, size_t sy,
+                     double ce, double ch) {
+  for (int m = 0; m < X; m++)
+    for (int n = 0; n < Y - 1; n++)
+      for (int p = 0; p < Z - 1; p++)
+        r->hx[IDX3(m, n, p, sx, sy)] +=
+            ch * ((r->ey[IDX3(m, n, p + 1, sx, sy)] -
+                   r->ey[IDX3(m, n, p, sx, sy)]) -
+                  (r->ez[IDX3(m, n + 1, p, sx, sy)] -
+                   r->ez[IDX3(m, n, p, sx, sy)]));
+  for (int m = 0; m < X - 1; m++)
+    for (int n = 0; n < Y; n++)
+      for (int p = 0; p < Z - 1; p++)
+        r->hy[IDX3(m, n, p, sx, sy)] +=
+            ch * ((r->ez[IDX3(m + 1, n, p, sx, sy)] -
+                   r->ez[IDX3(m, n, p, sx, sy)]) -
+                  (r->ex[IDX3(m, n, p + 1, sx, sy)] -
+                   r->ex[IDX3(m, n, p, sx, sy)]));
+  for (int m = 0; m < X - 1; m++)
+    for (int n = 0; n < Y - 1; n++)
+      for (int p = 0; p < Z; p++)
+        r->hz[IDX3(m, n, p, sx, sy)] +=
+            ch * ((r->ex[IDX3(m, n + 1, p, sx, sy)] -
+                   r->ex[IDX3(m, n, p, sx, sy)]) -
+                  (r->ey[IDX3(m + 1, n, p, sx, sy)] -
+                   r->ey[IDX3(m, n, p, sx, sy)]));
+
+  for (int m = 0; m < X - 1; m++)
+    for (int n = 1; n < Y - 1; n++)
+      for (int p = 1; p < Z - 1; p++)
+        r->ex[IDX3(m, n, p, sx, sy)] +=
+            ce * ((r->hz[IDX3(m, n, p, sx, sy)] -
+                   r->hz[IDX3(m, n - 1, p, sx, sy)]) -
+                  (r->hy[IDX3(m, n, p, sx, sy)] -
+                   r->hy[IDX3(m, n, p - 1, sx, sy)]));
+  for (int m = 1; m < X - 1; m++)
+    for (int n = 0; n < Y - 1; n++)
+      for (int p = 1; p < Z - 1; p++)
+        r->ey[IDX3(m, n, p, sx, sy)] +=
+            ce * ((r->hx[IDX3(m, n, p, sx, sy)] -
+                   r->hx[IDX3(m, n, p - 1, sx, sy)]) -
+                  (r->hz[IDX3(m, n, p, sx, sy)] -
+                   r->hz[IDX3(m - 1, n, p, sx, sy)]));
+  for (int m = 1; m < X - 1; m++)
+    for (int n = 1; n < Y - 1; n++)
+      for (int p = 0; p < Z - 1; p++)
+        r->ez[IDX3(m, n, p, sx, sy)] +=
+            ce * ((r->hy[IDX3(m, n, p, sx, sy)] -
+                   r->hy[IDX3(m - 1, n, p, sx, sy)]) -
+                  (r->hx[IDX3(m, n, p, sx, sy)] -
+                   r->hx[IDX3(m, n - 1, p, sx, sy)]));
+}
+
+// Accumulates w * sum((a - b)^2), w * sum(b^2) and w * sum(a^2).
+static void diff(const Real *a, const double *b, size_t n, double w,
+                 double acc[3]) {
+  for (size_t i = 0; i < n; i++) {
+    double d = (double)a[i] - b[i];
+    acc[0] += w * d * d;
+    acc[1] += w * b[i] * b[i];
+    acc[2] += w * (double)a[i] * a[i];
+  }
+}
+
+int main(int argc, char *argv[]) {
+  int size  = argc > 1 ? atoi(argv[1]) : 64;
+  int steps = argc > 2 ? atoi(argv[2]) : 400;
+
+  int    X = size, Y = size, Z = size;
+  double cdtds = 1.0 / sqrt(3.0), imp0 = 377.0;
+
+  Grid g = {0};
+  if (!grid_init(&g, ThreeDimension,
+                 (GridParameter){
+                     .sizeX   = X,
+                     .sizeY   = Y,
+                     .sizeZ   = Z,
+                     .maxTime = steps,
+                     .cdtds   = cdtds,
+                     .imp0    = imp0,
+                     .uniform = true,
+                 }))
+    return EXIT_FAILURE;
+
+  // The reference uses the grid's padded layout, so arrays compare 1:1.
+  size_t sx  = g.sx, sy = g.sy, n = (size_t)X * sx;
+  size_t src = IDX3(X / 2, Y / 2, Z / 2, sx, sy);
+
+  RefGrid r = {0};
+  CALLOC(r.ex, double, n);
+  CALLOC(r.ey, double, n);
+  CALLOC(r.ez, double, n);
+  CALLOC(r.hx, double, n);
+  CALLOC(r.hy, double, n);
+  CALLOC(r.hz, double, n);
+
+  fprintf(stderr, "precision %s, sizeof(Real) %zu, grid %d^3, %d steps\n",
+          FDTD_PRECISION, sizeof(Real), size, steps);
+  fprintf(stderr, "%6s %12s %12s %12s %10s\n", "step", "max |dEz|", "rel L2",
+          "rel energy", "ms/step");
+
+  double engine = 0.0;
+  for (g.time = 0; g.time < steps; g.time++) {
+    double t0 = now();
+    updateH(&g);
+    updateE(&g);
+    g.ez[src] += source(g.time);
+    engine += now() - t0;
+
+    ref_step(&r, X, Y, Z, sx, sy, cdtds * imp0, cdtds / imp0);
+    r.ez[src] += source(g.time);
+
+    if ((g.time + 1) % (steps / 4 > 0 ? steps / 4 : 1) != 0)
+      continue;
+
+    double peak = 0.0, worst = 0.0;
+    for (size_t i = 0; i < n; i++) {
+      peak  = fmax(peak, fabs(r.ez[i]));
+      worst = fmax(worst, fabs((double)g.ez[i] - r.ez[i]));
+    }
+
+    double w = imp0 * imp0, acc[3] = {0};
+    diff(g.ex, r.ex, n, 1.0, acc);
+    diff(g.ey, r.ey, n, 1.0, acc);
+    diff(g.ez, r.ez, n, 1.0, acc);
+    diff(g.hx, r.hx, n, w, acc);
+    diff(g.hy, r.hy, n, w, acc);
+    diff(g.hz, r.hz, n, w, acc);
+
+    fprintf(stderr, "%6d %12.3e %12.3e %12.3e %10.2f\n", g.time + 1,
+            peak > 0.0 ? worst / peak : 0.0,
+            acc[1] > 0.0 ? sqrt(acc[0] / acc[1]) : 0.0,
+            acc[1] > 0.0 ? fabs(acc[2] - acc[1]) / acc[1] : 0.0,
+            engine * 1e3 / (g.time + 1));
+  }
+
+  FREE(r.ex);
+  FREE(r.ey);
+  FREE(r.ez);
+  FREE(r.hx);
+  FREE(r.hy);
+  FREE(r.hz);
+  grid_free(&g);
+  return EXIT_SUCCESS;
+}
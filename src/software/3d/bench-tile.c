@@ -0,0 +1,236 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#define FDTD_IMPLEMENTATION
+#include "fdtd.h"
+#define NOB_IMPLEMENTATION
+#include "../../../nob.h"
+
+/*
+ * Tiled and temporally blocked vs untiled 3D sweep.
+ *
+ *   ./bench-tile [size] [steps] [threads] [huge] > /dev/null
+ *
+ * The table goes to stderr, after the page placement of the first grid; a
+ * non-zero [huge] backs every grid with 2 MB transparent huge pages. Besides
+ * time per step, every configuration is converted to an estimated number of
+ * DRAM bytes per cell update by multiplying its run time with the triad
+ * bandwidth measured at startup.
+ * The untiled loops stream each of the six component passes separately
+ * (about 288 B/cell), so the drop in that column is the traffic a tile shape
+ * saves. Rows with k > 1 advance each tile k steps at a time through
+ * grid_step_blocked, and the "fused" row uses the plane-streaming
+ * grid_step_fused engine. "uni" rows repeat a configuration on a grid
+ * created with .uniform, which has no coefficient arrays to stream, and
+ * "active" rows sweep only the box the source has reached so far
+ * (.activeRegion). "aos" rows store the grid row-interleaved
+ * (.interleaved), the choice between the two layouts being per machine.
+ * "cpml" rows attach a 10-layer CPML, so their speedup against the untiled
+ * row is the cost of the absorber. Every run is compared bit for bit against
+ * the untiled result, the cpml rows against the first of them.
+ */
+
+typedef struct {
+  const char *name;
+  int         tx, ty, tz;
+  int         k;
+  bool        fused;
+  bool        uniform;
+  bool        active;
+  bool        interleaved;
+  bool        cpml;
+} TileShape;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// STREAM-style triad over arrays far larger than the last level cache.
+static double triad_bandwidth(void) {
+  size_t  n = (size_t)16 << 20;
+  double *a, *b, *c;
+  double  best = 0.0;
+
+  CALLOC(a, double, n);
+  CALLOC(b, double, n);
+  CALLOC(c, double, n);
+  for (size_t i = 0; i < n; i++) {
+    b[i] = 1.0;
+    c[i] = 2.0;
+  }
+
+  for (int rep = 0; rep < 5; rep++) {
+    double t0 = now();
+    for (size_t i = 0; i < n; i++)
+      a[i] = b[i] + 3.0 * c[i];
+    double t1 = now();
+    double bw = 3.0 * n * sizeof(double) / (t1 - t0);
+    if (bw > best)
+      best = bw;
+  }
+
+  if (a[n / 2] != 7.0)
+    fprintf(stderr, "triad check failed\n");
+
+  free(a);
+  free(b);
+  free(c);
+  return best;
+}
+
+static Box3d source_box(const Grid *grid) {
+  int mm = (grid->param.sizeX - 1) / 2;
+  int nn = grid->param.sizeY / 2;
+  int pp = grid->param.sizeZ / 2;
+  return (Box3d){mm, mm + 1, nn, nn + 1, pp, pp + 1};
+}
+
+static void add_source(Grid *grid, int time, Box3d box, void *user) {
+  (void)user;
+  Box3d src = source_box(grid);
+
+  if (src.x0 < box.x0 || src.x0 >= box.x1 || src.y0 < box.y0 ||
+      src.y0 >= box.y1)
+    return;
+  grid->ex[IDX3(src.x0, src.y0, src.z0, grid->sx, grid->sy)] +=
+      sin(0.05 * time);
+}
+
+// Ez without padding, so grids with different layouts compare directly.
+static void copy_ez(const Grid *grid, Real *out) {
+  int X = grid->param.sizeX, Y = grid->param.sizeY, Z = grid->param.sizeZ;
+
+  for (int m = 0; m < X; m++)
+    for (int n = 0; n < Y; n++)
+      memcpy(&out[IDX3(m, n, 0, (size_t)Y * Z, Z)],
+             &grid->ez[IDX3(m, n, 0, grid->sx, grid->sy)], Z * sizeof(Real));
+}
+
+static double run(Grid *grid, int steps, bool fused) {
+  double t0 = now();
+
+  if (fused) {
+    grid_step_fused(grid, steps, add_source, NULL);
+    return now() - t0;
+  }
+
+  if (grid->param.timeBlock > 1) {
+    grid_step_blocked(grid, steps, add_source, NULL);
+    return now() - t0;
+  }
+
+  for (grid->time = 0; grid->time < steps; grid->time++) {
+    updateH(grid);
+    updateE(grid);
+    add_source(grid, grid->time,
+               (Box3d){0, grid->param.sizeX, 0, grid->param.sizeY, 0,
+                       grid->param.sizeZ},
+               NULL);
+  }
+  return now() - t0;
+}
+
+int main(int argc, char *argv[]) {
+  int  size    = argc > 1 ? atoi(argv[1]) : 192;
+  int  steps   = argc > 2 ? atoi(argv[2]) : 10;
+  int  threads = argc > 3 ? atoi(argv[3]) : 1;
+  bool huge    = argc > 4 && atoi(argv[4]) != 0;
+
+  TileShape shapes[] = {
+      {    "untiled",  0,  0,  0, 0, false, false, false, false, false},
+      {      "8x8xZ",  8,  8,  0, 0, false, false, false, false, false},
+      {     "4x16xZ",  4, 16,  0, 0, false, false, false, false, false},
+      {    "16x16xZ", 16, 16,  0, 0, false, false, false, false, false},
+      {     "8x32xZ",  8, 32,  0, 0, false, false, false, false, false},
+      {    "32x32xZ", 32, 32,  0, 0, false, false, false, false, false},
+      {     "8x8x64",  8,  8, 64, 0, false, false, false, false, false},
+      {   "16x16x64", 16, 16, 64, 0, false, false, false, false, false},
+      {   "16x16 k2", 16, 16,  0, 2, false, false, false, false, false},
+      {   "16x16 k4", 16, 16,  0, 4, false, false, false, false, false},
+      {   "32x32 k4", 32, 32,  0, 4, false, false, false, false, false},
+      {   "32x32 k8", 32, 32,  0, 8, false, false, false, false, false},
+      {   "64x64 k8", 64, 64,  0, 8, false, false, false, false, false},
+      {      "fused",  0,  0,  0, 0,  true, false, false, false, false},
+      {"uni untiled",  0,  0,  0, 0, false,  true, false, false, false},
+      { "uni 8x32xZ",  8, 32,  0, 0, false,  true, false, false, false},
+      {"uni 32x32k4", 32, 32,  0, 4, false,  true, false, false, false},
+      {  "uni fused",  0,  0,  0, 0,  true,  true, false, false, false},
+      {     "active",  0,  0,  0, 0, false, false,  true, false, false},
+      { "uni active",  0,  0,  0, 0, false,  true,  true, false, false},
+      {"aos untiled",  0,  0,  0, 0, false, false, false,  true, false},
+      { "aos 8x32xZ",  8, 32,  0, 0, false, false, false,  true, false},
+      {"aos 32x32k4", 32, 32,  0, 4, false, false, false,  true, false},
+      {  "aos fused",  0,  0,  0, 0,  true, false, false,  true, false},
+      {    "aos uni",  0,  0,  0, 0, false,  true, false,  true, false},
+      {       "cpml",  0,  0,  0, 0, false, false, false, false,  true},
+      {  "cpml 8x32",  8, 32,  0, 0, false, false, false, false,  true},
+      {  "cpml 32k4", 32, 32,  0, 4, false, false, false, false,  true},
+      { "cpml fused",  0,  0,  0, 0,  true, false, false, false,  true},
+      {   "cpml uni",  0,  0,  0, 0, false,  true, false, false,  true},
+  };
+
+  double  bw    = triad_bandwidth();
+  double  cells = (double)size * size * size;
+  double  base  = 0.0;
+  size_t  ez_n  = (size_t)size * size * size;
+  Real   *ref   = NULL, *ez = NULL;
+
+  CALLOC(ref, Real, ez_n);
+  CALLOC(ez, Real, ez_n);
+  fprintf(stderr, "grid %d^3, %d steps, %d threads, triad %.1f GB/s\n", size,
+          steps, threads, bw * 1e-9);
+
+  for (size_t i = 0; i < NOB_ARRAY_LEN(shapes); i++) {
+    Grid            g     = {0};
+    BoundaryParam3d abc   = {.layers = 10};
+    bool            first = i == 0 || shapes[i].cpml != shapes[i - 1].cpml;
+
+    if (!grid_init(&g, ThreeDimension,
+                   (GridParameter){
+                       .sizeX        = size,
+                       .sizeY        = size,
+                       .sizeZ        = size,
+                       .maxTime      = steps,
+                       .cdtds        = 1.0 / sqrt(3.0),
+                       .imp0         = 377.0,
+                       .threads      = threads,
+                       .tileX        = shapes[i].tx,
+                       .tileY        = shapes[i].ty,
+                       .tileZ        = shapes[i].tz,
+                       .timeBlock    = shapes[i].k,
+                       .uniform      = shapes[i].uniform,
+                       .hugePages    = huge,
+                       .pageReport   = i == 0,
+                       .activeRegion = shapes[i].active,
+                       .interleaved  = shapes[i].interleaved,
+                   }))
+      return EXIT_FAILURE;
+    if (shapes[i].cpml && !boundary_init_3d(&g, cPML, &abc))
+      return EXIT_FAILURE;
+    grid_activate(&g, source_box(&g));
+    if (i == 0)
+      fprintf(stderr, "%-11s %10s %10s %8s %10s %6s\n", "tile", "ms/step",
+              "Mcell/s", "speedup", "est B/cell", "check");
+
+    double t = run(&g, steps, shapes[i].fused) / steps;
+    copy_ez(&g, first ? ref : ez);
+    if (i == 0)
+      base = t;
+    if (first)
+      memcpy(ez, ref, ez_n * sizeof(Real));
+    bool same = memcmp(ref, ez, ez_n * sizeof(Real)) == 0;
+
+    fprintf(stderr, "%-11s %10.2f %10.1f %8.2f %10.0f %6s\n", shapes[i].name,
+            t * 1e3, cells / t * 1e-6, base / t, t * bw / cells,
+            same ? "ok" : "DIFF");
+    grid_free(&g);
+  }
+
+  free(ref);
+  free(ez);
+  return EXIT_SUCCESS;
+}
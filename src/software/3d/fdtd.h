@@ -2,6 +2,28 @@
 #define FDTD_H_
 #include "../../../nob.h"
 #include <math.h>
+#include <pthread.h>
+
+/*
+ * Field and coefficient precision of the software engine. The default is
+ * double; -DFDTD_FLOAT stores and computes in float like the HLS kernels,
+ * and -DFDTD_MIXED stores float but evaluates every update in double.
+ */
+#if defined(FDTD_FLOAT) && defined(FDTD_MIXED)
+  #error "FDTD_FLOAT and FDTD_MIXED are mutually exclusive"
+#elif defined(FDTD_FLOAT)
+typedef float Real;
+typedef float Accum;
+  #define FDTD_PRECISION "float"
+#elif defined(FDTD_MIXED)
+typedef float  Real;
+typedef double Accum;
+  #define FDTD_PRECISION "mixed"
+#else
+typedef double Real;
+typedef double Accum;
+  #define FDTD_PRECISION "double"
+#endif
 
 typedef enum {
   OneDimension,
@@ -10,55 +32,339 @@ typedef enum {
   ThreeDimension,
 } GridType;
 
+typedef enum {
+  SimdAuto,
+  SimdScalar,
+  SimdSSE2,
+  SimdAVX2,
+  SimdAVX512,
+} SimdLevel;
+
 typedef struct {
-  int    sizeX, sizeY, sizeZ;
-  int    maxTime;
-  double cdtds;
-  double imp0;
+  int       sizeX, sizeY, sizeZ;
+  int       maxTime;
+  double    cdtds;
+  double    imp0;
+  int       threads;             // 3D: slab workers, <= 1 is serial
+  SimdLevel simd;                // 3D: widest curl kernel, SimdAuto = CPUID
+  int       tileX, tileY, tileZ; // 3D: cache tile extents, 0 = whole axis
+  int       timeBlock;           // 3D: steps per block, grid_step_blocked
+  bool      uniform;             // 3D: free space, no coefficient arrays
+  int       padLines;            // 3D: extra cache lines per padded row
+  int       materials;           // 3D: > 0 = material-ID table entries
+  bool      hugePages;           // back the arena with 2 MB THP pages
+  bool      pageReport;          // print arena page placement after init
+  bool      activeRegion;        // 3D: sweep grid->active, grid_activate
+  bool      interleaved;         // 3D: row-interleaved (AoS) layout
 } GridParameter;
 
+// Half-open index box [x0, x1) x [y0, y1) x [z0, z1).
+typedef struct {
+  int x0, x1;
+  int y0, y1;
+  int z0, z1;
+} Box3d;
+
+typedef struct ThreadPool      ThreadPool;
+typedef struct BoundaryParam3d BoundaryParam3d;
+typedef struct Tfsf3d          Tfsf3d;
+typedef struct Wire            Wire;
+
+/*
+ * Named instrumentation scopes. Built with -DFDTD_PROFILE every scope
+ * accumulates call count, nanoseconds and cells touched, and grid_free
+ * prints the table; without it PROF_BEGIN/PROF_END compile to nothing.
+ * Component scopes (update_hx, ...) add up time across workers, the phase
+ * scopes (update_h, step_fused, ...) are wall time on the calling thread.
+ */
+typedef enum {
+  ProfUpdateH,
+  ProfUpdateE,
+  ProfStepBlocked,
+  ProfStepFused,
+  ProfUpdateHx,
+  ProfUpdateHy,
+  ProfUpdateHz,
+  ProfUpdateEx,
+  ProfUpdateEy,
+  ProfUpdateEz,
+  ProfBoundary,
+  ProfSource,
+  ProfTfsf,
+  ProfSnapshot,
+  ProfCount,
+} ProfScope;
+
+typedef struct {
+  uint64_t calls;
+  uint64_t nanos;
+  uint64_t cells;
+} ProfStat;
+
+#ifdef FDTD_PROFILE
+  #define PROF_BEGIN() prof_now()
+  #define PROF_END(GRID, SCOPE, START, CELLS)                                  \
+    prof_add((GRID), (SCOPE), (START), (CELLS))
+#else
+  #define PROF_BEGIN() ((uint64_t)0)
+  #define PROF_END(GRID, SCOPE, START, CELLS)                                  \
+    ((void)(GRID), (void)(START), (void)sizeof(CELLS))
+#endif
+
+typedef void (*CurlRow)(Real *f, const Real *cf, const Real *cg,
+                        const Real *a1, const Real *a0, const Real *b1,
+                        const Real *b0, int n);
+
+// Same update for a uniform medium: cf is 1 and cg a single constant.
+typedef void (*CurlRowConst)(Real *f, Real cg, const Real *a1,
+                             const Real *a0, const Real *b1, const Real *b0,
+                             int n);
+
+// Material-ID update: cf/cg are per-material tables indexed by id[i], which
+// points at uint8_t or uint16_t IDs depending on Grid.mat_width.
+typedef void (*CurlRowMat)(Real *f, const void *id, const Real *cf,
+                           const Real *cg, const Real *a1, const Real *a0,
+                           const Real *b1, const Real *b0, int n);
+
+// First-order Mur row: f = old + coef * (in - f), then old = in.
+typedef void (*MurRow)(Real *f, const Real *in, Real *old, Real coef, int n);
+
+// CPML row: psi = b * psi + a * (f1 - f0), then f += k * psi. b and a are
+// per cell (step 1) or one value for the row (step 0); k = g * cg[i], or g
+// alone with cg NULL.
+typedef void (*PmlRow)(Real *f, const Real *f1, const Real *f0, Real *psi,
+                       const Real *pb, const Real *pa, int step,
+                       const Real *cg, Real g, int n);
+
+// Source gather-add: f[offset[i]] += amp[i] * row[wave[i]].
+typedef void (*SourceRow)(Real *f, const size_t *offset, const int *wave,
+                          const Real *amp, const Real *row, int n);
+
 typedef struct {
-  int           time;
-  double       *hx, *chxh, *chxe;
-  double       *hy, *chyh, *chye;
-  double       *hz, *chzh, *chze;
-  double       *ex, *cexe, *cexh;
-  double       *ey, *ceye, *ceyh;
-  double       *ez, *ceze, *cezh;
-  GridType      type;
-  GridParameter param;
+  int              time;
+  Real            *hx, *chxh, *chxe;
+  Real            *hy, *chyh, *chye;
+  Real            *hz, *chzh, *chze;
+  Real            *ex, *cexe, *cexh;
+  Real            *ey, *ceye, *ceyh;
+  Real            *ez, *ceze, *cezh;
+  GridType         type;
+  GridParameter    param;
+  ThreadPool      *pool;
+  SimdLevel        simd;
+  CurlRow          curl_row;
+  CurlRowConst     curl_row_const;
+  Real             ce, ch; // uniform medium: cdtds * imp0, cdtds / imp0
+  uint8_t         *mex, *mey, *mez;   // material mode: IDs of mat_width bytes
+  uint8_t         *mhx, *mhy, *mhz;
+  int              mat_width;         // 1 (uint8_t IDs) or 2 (uint16_t IDs)
+  Real            *mat_cee, *mat_ceh; // per material: E self / curl coefficient
+  Real            *mat_chh, *mat_che; // per material: H self / curl coefficient
+  CurlRowMat       curl_row_mat;
+  MurRow           mur_row;
+  PmlRow           pml_row;
+  SourceRow        source_row;
+  BoundaryParam3d *abc;        // 3D: boundary finished in the sweeps
+  const Tfsf3d    *tfsf;       // 3D: TFSF box applied in the sweeps
+  Wire            *wires;      // 3D: thin wires applied in the sweeps
+  int              wire_count;
+  void            *arena;      // every array above, one aligned allocation
+  size_t           arena_size; // bytes, a multiple of the arena alignment
+  size_t           sx, sy;     // 3D: x and y strides shared by all components
+  size_t           row;        // 3D: padded z row of one component, <= sy
+  Box3d            active;     // 3D activeRegion: may hold non-zero fields
+  int              fixed;      // 3D: fixed-extent kernel entry, -1 = generic
+  ProfStat         prof[ProfCount];
 } Grid;
 
+/*
+ * Called by grid_step_blocked/grid_step_fused once step `time` has updated E
+ * inside `box` (already clipped to the grid). Anything the caller would
+ * normally do after updateE, such as adding a source, must only touch cells
+ * inside `box`.
+ */
+typedef void (*StepHook)(Grid *grid, int time, Box3d box, void *user);
+
 typedef enum {
   ABC,
-  PML,
+  PML, // 3D: the same convolutional PML as cPML
   cPML,
+  Periodic,
 } BoundaryType;
 
+typedef enum {
+  NoSymmetry,
+  ElectricWall, // PEC mirror plane
+  MagneticWall, // PMC mirror plane
+} Symmetry;
+
 typedef struct {
-  double  coef0, coef1, coef2;
-  double *ezLeft, *ezRight, *ezTop, *ezBottom;
+  double coef0, coef1, coef2;
+  Real  *ezLeft, *ezRight, *ezTop, *ezBottom;
 } BoundaryParam;
 
-typedef struct {
-  double  coef;
-  double *exy0, *exy1, *exz0, *exz1;
-  double *eyx0, *eyx1, *eyz0, *eyz1;
-  double *ezx0, *ezx1, *ezy0, *ezy1;
-} BoundaryParam3d;
+/*
+ * State of a 3D boundary, filled in by boundary_init_3d.
+ *
+ * ABC: Mur history of the tangential E components, one array per component
+ * and face in the order x0, x1, y0, y1, z0, z1 (NULL for the two faces
+ * normal to the component). x and y faces are stored as rows of grid->row
+ * along z, z faces as sizeX x sizeY. A high x or y face is advanced together
+ * with the E row before it, ahead of the H beside it in the fused and
+ * blocked engines. Hx on the high x face and Hy on the high y face feed no E
+ * update, so with the ABC attached they are not swept at all and read zero
+ * in every engine.
+ *
+ * cPML: `layers` is the only input. psi holds the auxiliary field of every
+ * component (ex, ey, ez, hx, hy, hz) and derivative axis, for the two slabs
+ * of layers + 1 cells across that axis only; pb/pa are the recursion
+ * coefficients per axis and index at E (integer) and H (half cell) nodes.
+ *
+ * periodic/phase/pair/imaginary are inputs for every type: the flagged axes
+ * are wrapped instead of absorbed (Periodic absorbs nothing, and wraps all
+ * three axes when none is flagged). A non-zero Bloch phase needs the other
+ * part of the complex field in `pair`, see periodic_fill.
+ *
+ * symmetry is an input for every type as well: a mirror plane through the
+ * low face of the axis, which then has no absorber, see mirror_box.
+ */
+struct BoundaryParam3d {
+  BoundaryType type;
+  double       coef;
+  Real        *ex[6], *ey[6], *ez[6];
+  int          layers; // cPML: cells per side, 0 = 10
+  Real        *psi[6][3];
+  Real        *pb[2][3], *pa[2][3];
+  bool         periodic[3]; // axes wrapped through halo planes
+  double       phase[3];    // Bloch phase shift per period, radians
+  Grid        *pair;        // Bloch: grid with the other part of the field
+  bool         imaginary;   // Bloch: this grid holds the imaginary part
+  Symmetry     symmetry[3]; // mirror plane at index 0 per axis
+  bool         zfold;       // z halos refreshed by the row sweeps
+  double       zcos;        // zfold: rotation of a z halo, cos(phase[2])
+};
 
 typedef enum {
   GaussianPulse,
   HarmonicSources,
   RickerWavelet,
+  Impulse, // unit sample at step 0, see impulse_convolve
 } SourceType;
 
 typedef struct {
   double time;
   double location;
-  int    ppw;
+  int    ppw; // cells per wavelength; GaussianPulse: pulse width in cells
 } SourceParameter;
 
+// Soft source cells of one component, in ascending offset once finished.
+typedef struct {
+  int     count;
+  size_t *offset;
+  int    *wave; // column of the waveform table
+  Real   *amp;
+} SourceCells;
+
+// A waveform as recorded by source_wave.
+typedef struct {
+  SourceType      type;
+  SourceParameter param;
+} SourceWave;
+
+/*
+ * Every soft source of a run: the waveforms tabulated once for steps
+ * [0, maxTime), time-major so one step reads a single row of `waves`
+ * values, and the cells of each component (ex, ey, ez, hx, hy, hz).
+ * source_wave only records a waveform in `wave`, source_finish fills the
+ * table. `unique` is set by source_finish when no cell appears twice, which
+ * lets source_inject use the SIMD scatter.
+ */
+typedef struct {
+  int         steps, waves;
+  double      cdtds;
+  SourceWave *wave; // NULL when the caller fills the table itself
+  Real       *table;
+  SourceCells cells[6];
+  bool        unique;
+} SourceSet;
+
+/*
+ * Total-field/scattered-field box for an Ez-polarised plane wave travelling
+ * along +x. The total field fills the node box `box` (half-open, as Box3d):
+ * Ez at nodes x0 <= m < x1, y0 <= n < y1 and between z planes z0 and z1 - 1,
+ * the other components likewise. The incident field is a 1D grid with the
+ * grid's cdtds and imp0, stepped once for all maxTime steps by tfsf_init:
+ * row t of `ez` is Ez_inc(x0 .. x1 - 1) as the H update of step t reads it,
+ * row t of `hy` is Hy_inc(x0 - 1 .. x1 - 1) as its E update reads it. The
+ * table depends on nothing else, so one can drive any number of grids or
+ * runs (tfsf_attach).
+ */
+struct Tfsf3d {
+  Box3d  box;
+  int    steps, width; // rows, and Ez_inc samples per row (x1 - x0)
+  double cdtds, imp0;
+  Real  *ez, *hy;      // steps x width, steps x (width + 1)
+};
+
+typedef struct {
+  int    c; // component, 0..5 = ex..hz
+  int    m, n, p;
+  size_t offset;
+} Probe;
+
+/*
+ * Field samples recorded every step, for impulse responses. `data` holds
+ * maxTime samples per probe, probe after probe in the order they were
+ * added; `order` lists the probes by ascending m for probe_record.
+ */
+typedef struct {
+  int    count, steps;
+  Probe *probe;
+  int   *order;
+  Real  *data;
+} ProbeSet;
+
+// A lumped resistive voltage source across one E edge.
+typedef struct {
+  int    c; // 0..2 = ex..ez
+  int    m, n, p;
+  size_t offset;
+  double resistance; // ohms, also the port's reference impedance
+  double drive;      // source term coefficient, -2 L / (1 + L)
+  double prev;       // -E of the previous step
+  Real   cf, cg;     // the edge's coefficients before port_add
+} Port;
+
+/*
+ * Ports driven all at once in disjoint frequency bands (port_finish). The
+ * range is split into `bands` slots of `count` sub-bands each and port j
+ * owns sub-band j of every slot, so monitor frequency k (a sub-band
+ * centre, ascending) belongs to port k % count. `v` and `i` hold the
+ * running DFT of every port's voltage and current at every monitor
+ * frequency, count x freqs complex values as (re, im).
+ */
+typedef struct {
+  int       count, bands, freqs;
+  Port     *port;
+  double   *freq; // cycles per step
+  double   *v, *i;
+  SourceSet source;
+} PortSet;
+
+/*
+ * A PEC wire thinner than a cell along `length` edges of component `axis`,
+ * starting at edge `at` (wire_add). The H samples circling it are corrected
+ * for a wire of the given radius; edge `gap` keeps its E, as a feed.
+ */
+struct Wire {
+  int    axis;   // 0..2 = x..z, also the E component on the wire
+  int    at[3];  // first edge
+  int    length; // edges
+  int    gap;    // edge along the wire left open, -1 = none
+  double factor; // 2 / ln(cell / radius), 1 for a bare staircased edge
+  Box3d  reach;  // samples wire_box touches
+};
+
 typedef struct {
   struct {
     int x, y;
@@ -93,32 +399,94 @@ typedef struct {
     (p) = NULL;                                                                \
   } while (0)
 
-#define IDX2(M, N, WIDTH)       ((M) * (WIDTH) + (N))
-#define IDX3(M, N, P, COL, ROW) ((((M) * (COL) + (N)) * (ROW) + (P)))
+#define GRID_ALIGN      64
+#define GRID_HUGE_ALIGN (2u << 20)
+
+/*
+ * Flat array offsets. Per-axis indices and extents are int, but offsets are
+ * always formed in size_t so grids beyond 2^31 cells index correctly.
+ */
+#define IDX2(M, N, WIDTH)     ((size_t)(M) * (size_t)(WIDTH) + (size_t)(N))
+#define IDX3(M, N, P, SX, SY) ((size_t)(M) * (SX) + (size_t)(N) * (SY) + (P))
 
 void updateH(Grid *grid);
 void updateE(Grid *grid);
+void grid_step_blocked(Grid *grid, int steps, StepHook hook, void *user);
+void grid_step_fused(Grid *grid, int steps, StepHook hook, void *user);
 
 bool grid_init(Grid *grid, GridType type, GridParameter param);
 bool grid_free(Grid *g);
 
 bool grid_init_lossy(Grid *grid, int nLoss, float maxLoss);
+bool grid_detect_uniform(Grid *grid);
+bool grid_material_set(Grid *grid, int id, double cee, double ceh, double chh,
+                       double che);
+bool grid_material_box(Grid *grid, Box3d box, int id);
+void grid_page_report(Grid *grid, FILE *out);
+void grid_activate(Grid *grid, Box3d box);
+
+const char *simd_name(SimdLevel level);
+
+uint64_t prof_now(void);
+void     prof_add(Grid *grid, ProfScope scope, uint64_t start, uint64_t cells);
+void     prof_report(Grid *grid, FILE *out);
 
 void boundary_init(Grid *grid, BoundaryType type, BoundaryParam *param);
 void boundary_abc(Grid *grid, BoundaryParam *param);
-void boundary_init_3d(Grid *grid, BoundaryType type, BoundaryParam3d *param);
-void boundary_abc_3d(Grid *grid, BoundaryParam3d *param);
+bool boundary_init_3d(Grid *grid, BoundaryType type, BoundaryParam3d *param);
+
+Box3d symmetry_box(const Grid *grid);
+Real  symmetry_field(const Grid *grid, int c, int m, int n, int p);
 
 double ez_source(Grid *grid, double time, double location, int ppw);
 double ez_source_input(Grid *grid, SourceType type, SourceParameter param);
 
+int  source_wave(Grid *grid, SourceSet *set, SourceType type,
+                 SourceParameter param);
+bool source_add(Grid *grid, SourceSet *set, int wave, int c, int m, int n,
+                int p, double amp);
+void source_finish(SourceSet *set);
+void source_inject(Grid *grid, const SourceSet *set, bool magnetic, int time,
+                   Box3d box);
+void source_free(SourceSet *set);
+
+bool probe_add(Grid *grid, ProbeSet *set, int c, int m, int n, int p);
+bool probe_plane(Grid *grid, ProbeSet *set, int c, int axis, int index);
+void probe_finish(Grid *grid, ProbeSet *set);
+void probe_record(Grid *grid, ProbeSet *set, int time, Box3d box);
+void probe_free(ProbeSet *set);
+bool impulse_convolve(Grid *grid, const ProbeSet *impulse, SourceType type,
+                      SourceParameter param, double *out);
+
+bool port_add(Grid *grid, PortSet *set, int c, int m, int n, int p,
+              double resistance);
+bool port_finish(Grid *grid, PortSet *set, double fmin, double fmax,
+                 int bands);
+void port_step(Grid *grid, PortSet *set, int time, Box3d box);
+bool port_matrix(const PortSet *set, int slot, double *freq, double *S,
+                 double *Z);
+void port_free(Grid *grid, PortSet *set);
+
+bool wire_add(Grid *grid, int axis, int m, int n, int p, int length,
+              double radius, int gap);
+
 void tfsfUpdate(Grid *grid, Grid *g_sub, tfsfRectangle rect);
+bool tfsf_init(Grid *grid, Tfsf3d *tfsf, Box3d box, SourceType type,
+               SourceParameter param);
+bool tfsf_attach(Grid *grid, const Tfsf3d *tfsf);
+void tfsf_free(Tfsf3d *tfsf);
 
 void snapshotGrid(Grid *grid, Snapshot *snap);
 void snapshotGrid3d(Grid *grid, Snapshot *snap);
 
 // #define FDTD_IMPLEMENTATION
 #ifdef FDTD_IMPLEMENTATION
+#ifdef __linux__
+  #include <sys/mman.h>
+  #include <sys/syscall.h>
+  #include <unistd.h>
+#endif
+
 static inline bool _mul_2_safe(size_t a, size_t b, size_t *out) {
   if (a == 0 || b == 0) {
     *out = 0;
@@ -137,34 +505,930 @@ static inline bool _mul_3_safe(size_t a, size_t b, size_t c, size_t *out) {
   return _mul_2_safe(tmp, c, out);
 }
 
-bool grid_free(Grid *g) {
-  if (!g) {
-    return false;
+static const char *prof_names[ProfCount] = {
+    [ProfUpdateH] = "update_h",         [ProfUpdateE] = "update_e",
+    [ProfStepBlocked] = "step_blocked", [ProfStepFused] = "step_fused",
+    [ProfUpdateHx] = "update_hx",       [ProfUpdateHy] = "update_hy",
+    [ProfUpdateHz] = "update_hz",       [ProfUpdateEx] = "update_ex",
+    [ProfUpdateEy] = "update_ey",       [ProfUpdateEz] = "update_ez",
+    [ProfBoundary] = "boundary",        [ProfSource] = "source",
+    [ProfTfsf] = "tfsf",                [ProfSnapshot] = "snapshot",
+};
+
+uint64_t prof_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Workers report concurrently, hence the atomics.
+void prof_add(Grid *grid, ProfScope scope, uint64_t start, uint64_t cells) {
+  ProfStat *st = &grid->prof[scope];
+  __atomic_fetch_add(&st->calls, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&st->nanos, prof_now() - start, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&st->cells, cells, __ATOMIC_RELAXED);
+}
+
+void prof_report(Grid *grid, FILE *out) {
+  bool any = false;
+  for (int i = 0; i < ProfCount; i++)
+    any |= grid->prof[i].calls > 0;
+  if (!any)
+    return;
+
+  fprintf(out, "%-14s %10s %12s %10s %10s\n", "scope", "calls", "total ms",
+          "avg us", "Mcell/s");
+  for (int i = 0; i < ProfCount; i++) {
+    ProfStat *st = &grid->prof[i];
+    if (st->calls == 0)
+      continue;
+    fprintf(out, "%-14s %10llu %12.3f %10.3f %10.1f\n", prof_names[i],
+            (unsigned long long)st->calls, st->nanos * 1e-6,
+            st->nanos * 1e-3 / st->calls,
+            st->nanos ? st->cells * 1e3 / st->nanos : 0.0);
+  }
+}
+
+static inline uint64_t _box_cells(int x0, int x1, int y0, int y1, int z0,
+                                  int z1) {
+  if (x1 <= x0 || y1 <= y0 || z1 <= z0)
+    return 0;
+  return (uint64_t)(x1 - x0) * (uint64_t)(y1 - y0) * (uint64_t)(z1 - z0);
+}
+
+static inline uint64_t _grid_cells(const Grid *grid) {
+  return _box_cells(0, grid->param.sizeX, 0, grid->param.sizeY, 0,
+                    grid->param.sizeZ);
+}
+
+static inline int _min_int(int a, int b) { return a < b ? a : b; }
+static inline int _max_int(int a, int b) { return a > b ? a : b; }
+
+static inline Box3d _grid_box(const Grid *grid) {
+  return (Box3d){0, grid->param.sizeX, 0, grid->param.sizeY, 0,
+                 grid->param.sizeZ};
+}
+
+static inline Box3d _box_clip(Box3d a, Box3d b) {
+  return (Box3d){
+      _max_int(a.x0, b.x0), _min_int(a.x1, b.x1), _max_int(a.y0, b.y0),
+      _min_int(a.y1, b.y1), _max_int(a.z0, b.z0), _min_int(a.z1, b.z1),
+  };
+}
+
+static inline bool _box_empty(Box3d b) {
+  return b.x1 <= b.x0 || b.y1 <= b.y0 || b.z1 <= b.z0;
+}
+
+// Cells one 3D phase sweeps: the active box in activeRegion mode.
+static inline uint64_t _swept_cells(const Grid *grid) {
+  Box3d b = grid->param.activeRegion ? grid->active : _grid_box(grid);
+  return _box_cells(b.x0, b.x1, b.y0, b.y1, b.z0, b.z1);
+}
+
+/*
+ * Yee curl row kernels. Every 3D component update has the same shape along
+ * the contiguous z axis:
+ *
+ *   f[i] = cf[i] * f[i] + cg[i] * ((a1[i] - a0[i]) - (b1[i] - b0[i]))
+ *
+ * so one kernel per instruction set covers all six components. The scalar
+ * version is the reference; the vector versions use separate mul/add (no
+ * FMA) and therefore match it bit for bit as long as the scalar code is not
+ * contracted either (-ffp-contract=off when building with -march=native).
+ * Operands are widened to Accum before any arithmetic, which only matters
+ * in FDTD_MIXED builds.
+ */
+#define CURL_EXPR(CF, F, CG, A1, A0, B1, B0)                                   \
+  ((Real)((Accum)(CF) * (F) +                                                  \
+          (Accum)(CG) * (((Accum)(A1) - (A0)) - ((Accum)(B1) - (B0)))))
+
+static void curl_row_scalar(Real *restrict f, const Real *restrict cf,
+                            const Real *restrict cg, const Real *a1,
+                            const Real *a0, const Real *b1, const Real *b0,
+                            int n) {
+  for (int i = 0; i < n; i++)
+    f[i] = CURL_EXPR(cf[i], f[i], cg[i], a1[i], a0[i], b1[i], b0[i]);
+}
+
+/*
+ * Uniform-medium variant: with cf == 1 the product cf * f is exact, so
+ * dropping it and reading cg from a register gives the same bits as the
+ * array kernel while streaming two arrays less per component.
+ */
+static void curl_row_const_scalar(Real *restrict f, Real cg, const Real *a1,
+                                  const Real *a0, const Real *b1,
+                                  const Real *b0, int n) {
+  for (int i = 0; i < n; i++)
+    f[i] = CURL_EXPR(1, f[i], cg, a1[i], a0[i], b1[i], b0[i]);
+}
+
+/*
+ * Material-ID variant: the coefficients come from a table of a few entries
+ * that stays in L1, so per cell only 1-2 bytes of ID are streamed instead of
+ * two coefficients. Same expression as the array kernel, so same bits.
+ */
+#define CURL_ROW_MAT_SCALAR(NAME, ID)                                          \
+  static void NAME(Real *restrict f, const void *ids, const Real *cf,          \
+                   const Real *cg, const Real *a1, const Real *a0,             \
+                   const Real *b1, const Real *b0, int n) {                    \
+    const ID *id = (const ID *)ids;                                            \
+    for (int i = 0; i < n; i++)                                                \
+      f[i] = CURL_EXPR(cf[id[i]], f[i], cg[id[i]], a1[i], a0[i], b1[i],        \
+                       b0[i]);                                                 \
+  }
+
+CURL_ROW_MAT_SCALAR(curl_row_m8_scalar, uint8_t)
+CURL_ROW_MAT_SCALAR(curl_row_m16_scalar, uint16_t)
+
+/*
+ * First-order Mur update of a boundary row from the row next to it, which
+ * the E sweep has just finished. f still holds the boundary value of the
+ * previous step and old the neighbour's:
+ *
+ *   f[i] = old[i] + coef * (in[i] - f[i]),  old[i] = in[i]
+ */
+#define MUR_EXPR(OLD, COEF, IN, F)                                             \
+  ((Real)((Accum)(OLD) + (Accum)(COEF) * ((Accum)(IN) - (F))))
+
+static void mur_row_scalar(Real *restrict f, const Real *restrict in,
+                           Real *restrict old, Real coef, int n) {
+  for (int i = 0; i < n; i++) {
+    Real e = in[i];
+    f[i]   = MUR_EXPR(old[i], coef, e, f[i]);
+    old[i] = e;
+  }
+}
+
+static void pml_row_scalar(Real *restrict f, const Real *f1, const Real *f0,
+                           Real *restrict psi, const Real *pb, const Real *pa,
+                           int step, const Real *cg, Real g, int n) {
+  for (int i = 0, j = 0; i < n; i++, j += step) {
+    Accum q = (Accum)pb[j] * psi[i] + (Accum)pa[j] * ((Accum)f1[i] - f0[i]);
+    Accum k = cg ? (Accum)(Real)(g * cg[i]) : (Accum)g;
+    psi[i]  = (Real)q;
+    f[i]    = (Real)(f[i] + k * q);
+  }
+}
+
+/*
+ * Soft source injection, a gather-add over the sorted source cells of one
+ * component: each cell adds its amplitude times its waveform's value for
+ * the step, read from the table row of that step.
+ */
+#define SOURCE_EXPR(F, AMP, W) ((Real)((Accum)(F) + (Accum)(AMP) * (W)))
+
+static void source_row_scalar(Real *f, const size_t *restrict offset,
+                              const int *restrict wave,
+                              const Real *restrict amp,
+                              const Real *restrict row, int n) {
+  for (int i = 0; i < n; i++)
+    f[offset[i]] = SOURCE_EXPR(f[offset[i]], amp[i], row[wave[i]]);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+  #include <immintrin.h>
+
+  // avx512f implies FMA, and GCC will happily fuse the mul/add intrinsics.
+  #if defined(__GNUC__) && !defined(__clang__)
+    #define CURL_ROW_TARGET(ISA) target(ISA), optimize("fp-contract=off")
+  #else
+    #define CURL_ROW_TARGET(ISA) target(ISA)
+  #endif
+
+  /*
+   * Vector ops per instruction set for the configured precision, named
+   * <ISA>_VEC, <ISA>_W, <ISA>_LOAD, ... so the instantiations below read
+   * the same for every precision. FDTD_MIXED computes in double lanes and
+   * converts at every load and store, which is exactly what the scalar
+   * CURL_EXPR does. INDEX widens W material IDs to 32-bit lanes for GATHER.
+   */
+  #if defined(FDTD_FLOAT)
+    #define SSE2_VEC   __m128
+    #define SSE2_W     4
+    #define SSE2_LOAD  _mm_loadu_ps
+    #define SSE2_STORE _mm_storeu_ps
+    #define SSE2_SET1  _mm_set1_ps
+    #define SSE2_ADD   _mm_add_ps
+    #define SSE2_SUB   _mm_sub_ps
+    #define SSE2_MUL   _mm_mul_ps
+
+    #define AVX2_VEC   __m256
+    #define AVX2_W     8
+    #define AVX2_LOAD  _mm256_loadu_ps
+    #define AVX2_STORE _mm256_storeu_ps
+    #define AVX2_SET1  _mm256_set1_ps
+    #define AVX2_ADD   _mm256_add_ps
+    #define AVX2_SUB   _mm256_sub_ps
+    #define AVX2_MUL   _mm256_mul_ps
+    #define AVX2_INDEX8(P)                                                     \
+      _mm256_cvtepu8_epi32(_mm_loadl_epi64((const void *)(P)))
+    #define AVX2_INDEX16(P)                                                    \
+      _mm256_cvtepu16_epi32(_mm_loadu_si128((const void *)(P)))
+    #define AVX2_GATHER(T, IX) _mm256_i32gather_ps((T), (IX), 4)
+
+    #define AVX512_VEC   __m512
+    #define AVX512_W     16
+    #define AVX512_LOAD  _mm512_loadu_ps
+    #define AVX512_STORE _mm512_storeu_ps
+    #define AVX512_SET1  _mm512_set1_ps
+    #define AVX512_ADD   _mm512_add_ps
+    #define AVX512_SUB   _mm512_sub_ps
+    #define AVX512_MUL   _mm512_mul_ps
+    #define AVX512_INDEX8(P)                                                   \
+      _mm512_cvtepu8_epi32(_mm_loadu_si128((const void *)(P)))
+    #define AVX512_INDEX16(P)                                                  \
+      _mm512_cvtepu16_epi32(_mm256_loadu_si256((const void *)(P)))
+    #define AVX512_GATHER(T, IX) _mm512_i32gather_ps((IX), (T), 4)
+  #else
+    #define SSE2_VEC  __m128d
+    #define SSE2_W    2
+    #define SSE2_SET1 _mm_set1_pd
+    #define SSE2_ADD  _mm_add_pd
+    #define SSE2_SUB  _mm_sub_pd
+    #define SSE2_MUL  _mm_mul_pd
+
+    #define AVX2_VEC  __m256d
+    #define AVX2_W    4
+    #define AVX2_SET1 _mm256_set1_pd
+    #define AVX2_ADD  _mm256_add_pd
+    #define AVX2_SUB  _mm256_sub_pd
+    #define AVX2_MUL  _mm256_mul_pd
+    #define AVX2_INDEX8(P) _mm_cvtepu8_epi32(_mm_loadu_si32(P))
+    #define AVX2_INDEX16(P)                                                    \
+      _mm_cvtepu16_epi32(_mm_loadl_epi64((const void *)(P)))
+
+    #define AVX512_VEC  __m512d
+    #define AVX512_W    8
+    #define AVX512_SET1 _mm512_set1_pd
+    #define AVX512_ADD  _mm512_add_pd
+    #define AVX512_SUB  _mm512_sub_pd
+    #define AVX512_MUL  _mm512_mul_pd
+    #define AVX512_INDEX8(P)                                                   \
+      _mm256_cvtepu8_epi32(_mm_loadl_epi64((const void *)(P)))
+    #define AVX512_INDEX16(P)                                                  \
+      _mm256_cvtepu16_epi32(_mm_loadu_si128((const void *)(P)))
+
+    #if defined(FDTD_MIXED)
+      #define SSE2_LOAD(P)                                                     \
+        _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((const void *)(P))))
+      #define SSE2_STORE(P, V)                                                 \
+        _mm_storel_epi64((void *)(P), _mm_castps_si128(_mm_cvtpd_ps(V)))
+      #define AVX2_LOAD(P)     _mm256_cvtps_pd(_mm_loadu_ps(P))
+      #define AVX2_STORE(P, V) _mm_storeu_ps((P), _mm256_cvtpd_ps(V))
+      #define AVX2_GATHER(T, IX)                                               \
+        _mm256_cvtps_pd(_mm_i32gather_ps((T), (IX), 4))
+      #define AVX512_LOAD(P)     _mm512_cvtps_pd(_mm256_loadu_ps(P))
+      #define AVX512_STORE(P, V) _mm256_storeu_ps((P), _mm512_cvtpd_ps(V))
+      #define AVX512_GATHER(T, IX)                                             \
+        _mm512_cvtps_pd(_mm256_i32gather_ps((T), (IX), 4))
+    #else
+      #define SSE2_LOAD            _mm_loadu_pd
+      #define SSE2_STORE           _mm_storeu_pd
+      #define AVX2_LOAD            _mm256_loadu_pd
+      #define AVX2_STORE           _mm256_storeu_pd
+      #define AVX2_GATHER(T, IX)   _mm256_i32gather_pd((T), (IX), 8)
+      #define AVX512_LOAD          _mm512_loadu_pd
+      #define AVX512_STORE         _mm512_storeu_pd
+      #define AVX512_GATHER(T, IX) _mm512_i32gather_pd((IX), (T), 8)
+    #endif
+  #endif
+
+  #define CURL_ROW_SIMD(NAME, TARGET, VEC, W, LOAD, STORE, ADD, SUB, MUL)     \
+    __attribute__((CURL_ROW_TARGET(TARGET))) static void NAME(                 \
+        Real *restrict f, const Real *restrict cf, const Real *restrict cg,    \
+        const Real *a1, const Real *a0, const Real *b1, const Real *b0,        \
+        int n) {                                                               \
+      int i = 0;                                                               \
+      for (; i + (W) <= n; i += (W)) {                                         \
+        VEC d = SUB(SUB(LOAD(a1 + i), LOAD(a0 + i)),                           \
+                    SUB(LOAD(b1 + i), LOAD(b0 + i)));                          \
+        STORE(f + i,                                                           \
+              ADD(MUL(LOAD(cf + i), LOAD(f + i)), MUL(LOAD(cg + i), d)));      \
+      }                                                                        \
+      for (; i < n; i++)                                                       \
+        f[i] = CURL_EXPR(cf[i], f[i], cg[i], a1[i], a0[i], b1[i], b0[i]);      \
+    }
+
+  #define CURL_ROW_CONST_SIMD(NAME, TARGET, VEC, W, LOAD, STORE, SET1, ADD,    \
+                              SUB, MUL)                                        \
+    __attribute__((CURL_ROW_TARGET(TARGET))) static void NAME(                 \
+        Real *restrict f, Real cg, const Real *a1, const Real *a0,             \
+        const Real *b1, const Real *b0, int n) {                               \
+      VEC vg = SET1(cg);                                                       \
+      int i  = 0;                                                              \
+      for (; i + (W) <= n; i += (W)) {                                         \
+        VEC d = SUB(SUB(LOAD(a1 + i), LOAD(a0 + i)),                           \
+                    SUB(LOAD(b1 + i), LOAD(b0 + i)));                          \
+        STORE(f + i, ADD(LOAD(f + i), MUL(vg, d)));                            \
+      }                                                                        \
+      for (; i < n; i++)                                                       \
+        f[i] = CURL_EXPR(1, f[i], cg, a1[i], a0[i], b1[i], b0[i]);             \
+    }
+
+  #define CURL_ROW_MAT_SIMD(NAME, TARGET, ID, VEC, W, LOAD, STORE, ADD, SUB,   \
+                            MUL, INDEX, GATHER)                                \
+    __attribute__((CURL_ROW_TARGET(TARGET))) static void NAME(                 \
+        Real *restrict f, const void *ids, const Real *cf, const Real *cg,     \
+        const Real *a1, const Real *a0, const Real *b1, const Real *b0,        \
+        int n) {                                                               \
+      const ID *id = (const ID *)ids;                                          \
+      int       i  = 0;                                                        \
+      for (; i + (W) <= n; i += (W)) {                                         \
+        VEC d = SUB(SUB(LOAD(a1 + i), LOAD(a0 + i)),                           \
+                    SUB(LOAD(b1 + i), LOAD(b0 + i)));                          \
+        STORE(f + i, ADD(MUL(GATHER(cf, INDEX(id + i)), LOAD(f + i)),          \
+                         MUL(GATHER(cg, INDEX(id + i)), d)));                  \
+      }                                                                        \
+      for (; i < n; i++)                                                       \
+        f[i] = CURL_EXPR(cf[id[i]], f[i], cg[id[i]], a1[i], a0[i], b1[i],      \
+                         b0[i]);                                               \
+    }
+
+CURL_ROW_SIMD(curl_row_sse2, "sse2", SSE2_VEC, SSE2_W, SSE2_LOAD, SSE2_STORE,
+              SSE2_ADD, SSE2_SUB, SSE2_MUL)
+CURL_ROW_SIMD(curl_row_avx2, "avx2", AVX2_VEC, AVX2_W, AVX2_LOAD, AVX2_STORE,
+              AVX2_ADD, AVX2_SUB, AVX2_MUL)
+CURL_ROW_SIMD(curl_row_avx512, "avx512f", AVX512_VEC, AVX512_W, AVX512_LOAD,
+              AVX512_STORE, AVX512_ADD, AVX512_SUB, AVX512_MUL)
+
+CURL_ROW_CONST_SIMD(curl_row_const_sse2, "sse2", SSE2_VEC, SSE2_W, SSE2_LOAD,
+                    SSE2_STORE, SSE2_SET1, SSE2_ADD, SSE2_SUB, SSE2_MUL)
+CURL_ROW_CONST_SIMD(curl_row_const_avx2, "avx2", AVX2_VEC, AVX2_W, AVX2_LOAD,
+                    AVX2_STORE, AVX2_SET1, AVX2_ADD, AVX2_SUB, AVX2_MUL)
+CURL_ROW_CONST_SIMD(curl_row_const_avx512, "avx512f", AVX512_VEC, AVX512_W,
+                    AVX512_LOAD, AVX512_STORE, AVX512_SET1, AVX512_ADD,
+                    AVX512_SUB, AVX512_MUL)
+
+CURL_ROW_MAT_SIMD(curl_row_m8_avx2, "avx2", uint8_t, AVX2_VEC, AVX2_W,
+                  AVX2_LOAD, AVX2_STORE, AVX2_ADD, AVX2_SUB, AVX2_MUL,
+                  AVX2_INDEX8, AVX2_GATHER)
+CURL_ROW_MAT_SIMD(curl_row_m16_avx2, "avx2", uint16_t, AVX2_VEC, AVX2_W,
+                  AVX2_LOAD, AVX2_STORE, AVX2_ADD, AVX2_SUB, AVX2_MUL,
+                  AVX2_INDEX16, AVX2_GATHER)
+CURL_ROW_MAT_SIMD(curl_row_m8_avx512, "avx512f", uint8_t, AVX512_VEC,
+                  AVX512_W, AVX512_LOAD, AVX512_STORE, AVX512_ADD, AVX512_SUB,
+                  AVX512_MUL, AVX512_INDEX8, AVX512_GATHER)
+CURL_ROW_MAT_SIMD(curl_row_m16_avx512, "avx512f", uint16_t, AVX512_VEC,
+                  AVX512_W, AVX512_LOAD, AVX512_STORE, AVX512_ADD, AVX512_SUB,
+                  AVX512_MUL, AVX512_INDEX16, AVX512_GATHER)
+
+  #define MUR_ROW_SIMD(NAME, TARGET, VEC, W, LOAD, STORE, SET1, ADD, SUB,     \
+                       MUL)                                                    \
+    __attribute__((CURL_ROW_TARGET(TARGET))) static void NAME(                 \
+        Real *restrict f, const Real *restrict in, Real *restrict old,         \
+        Real coef, int n) {                                                    \
+      VEC vc = SET1(coef);                                                     \
+      int i  = 0;                                                              \
+      for (; i + (W) <= n; i += (W)) {                                         \
+        VEC e = LOAD(in + i);                                                  \
+        STORE(f + i, ADD(LOAD(old + i), MUL(vc, SUB(e, LOAD(f + i)))));        \
+        STORE(old + i, e);                                                     \
+      }                                                                        \
+      for (; i < n; i++) {                                                     \
+        Real e = in[i];                                                        \
+        f[i]   = MUR_EXPR(old[i], coef, e, f[i]);                              \
+        old[i] = e;                                                            \
+      }                                                                        \
+    }
+
+MUR_ROW_SIMD(mur_row_sse2, "sse2", SSE2_VEC, SSE2_W, SSE2_LOAD, SSE2_STORE,
+             SSE2_SET1, SSE2_ADD, SSE2_SUB, SSE2_MUL)
+MUR_ROW_SIMD(mur_row_avx2, "avx2", AVX2_VEC, AVX2_W, AVX2_LOAD, AVX2_STORE,
+             AVX2_SET1, AVX2_ADD, AVX2_SUB, AVX2_MUL)
+MUR_ROW_SIMD(mur_row_avx512, "avx512f", AVX512_VEC, AVX512_W, AVX512_LOAD,
+             AVX512_STORE, AVX512_SET1, AVX512_ADD, AVX512_SUB, AVX512_MUL)
+
+  // One PmlRow loop with B, A and K the lane values of b, a and k.
+  #define PML_ROW_LOOP(VEC, W, LOAD, STORE, ADD, SUB, MUL, B, A, K)           \
+    for (; i + (W) <= n; i += (W)) {                                           \
+      VEC q = ADD(MUL(B, LOAD(psi + i)),                                       \
+                  MUL(A, SUB(LOAD(f1 + i), LOAD(f0 + i))));                    \
+      STORE(psi + i, q);                                                       \
+      STORE(f + i, ADD(LOAD(f + i), MUL(K, q)));                               \
+    }
+
+  #define PML_ROW_SIMD(NAME, TARGET, VEC, W, LOAD, STORE, SET1, ADD, SUB,     \
+                       MUL)                                                    \
+    __attribute__((CURL_ROW_TARGET(TARGET))) static void NAME(                 \
+        Real *restrict f, const Real *f1, const Real *f0, Real *restrict psi,  \
+        const Real *pb, const Real *pa, int step, const Real *cg, Real g,      \
+        int n) {                                                               \
+      VEC vb = SET1(pb[0]), va = SET1(pa[0]), vg = SET1(g);                    \
+      int i = 0;                                                               \
+      if (step && cg)                                                          \
+        PML_ROW_LOOP(VEC, W, LOAD, STORE, ADD, SUB, MUL, LOAD(pb + i),         \
+                     LOAD(pa + i), MUL(vg, LOAD(cg + i)))                      \
+      else if (step)                                                           \
+        PML_ROW_LOOP(VEC, W, LOAD, STORE, ADD, SUB, MUL, LOAD(pb + i),         \
+                     LOAD(pa + i), vg)                                         \
+      else if (cg)                                                             \
+        PML_ROW_LOOP(VEC, W, LOAD, STORE, ADD, SUB, MUL, vb, va,               \
+                     MUL(vg, LOAD(cg + i)))                                    \
+      else                                                                     \
+        PML_ROW_LOOP(VEC, W, LOAD, STORE, ADD, SUB, MUL, vb, va, vg)           \
+      pml_row_scalar(f + i, f1 + i, f0 + i, psi + i, pb + i * step,            \
+                     pa + i * step, step, cg ? cg + i : NULL, g, n - i);       \
+    }
+
+PML_ROW_SIMD(pml_row_sse2, "sse2", SSE2_VEC, SSE2_W, SSE2_LOAD, SSE2_STORE,
+             SSE2_SET1, SSE2_ADD, SSE2_SUB, SSE2_MUL)
+PML_ROW_SIMD(pml_row_avx2, "avx2", AVX2_VEC, AVX2_W, AVX2_LOAD, AVX2_STORE,
+             AVX2_SET1, AVX2_ADD, AVX2_SUB, AVX2_MUL)
+PML_ROW_SIMD(pml_row_avx512, "avx512f", AVX512_VEC, AVX512_W, AVX512_LOAD,
+             AVX512_STORE, AVX512_SET1, AVX512_ADD, AVX512_SUB, AVX512_MUL)
+
+  /*
+   * AVX-512 source gather-add, eight cells per iteration through 64-bit
+   * offset gathers and scatters, which needs distinct offsets (see
+   * SourceSet.unique). SRC8_* are the eight-lane ops of the precision.
+   */
+  #if defined(__x86_64__)
+    #if defined(FDTD_FLOAT)
+      #define SRC8_VEC            __m256
+      #define SRC8_LOAD           _mm256_loadu_ps
+      #define SRC8_ADD            _mm256_add_ps
+      #define SRC8_MUL            _mm256_mul_ps
+      #define SRC8_TABLE(T, IX)   _mm256_i32gather_ps((T), (IX), 4)
+      #define SRC8_FIELD(F, IX)   _mm512_i64gather_ps((IX), (F), 4)
+      #define SRC8_SCATTER(F, IX, V) _mm512_i64scatter_ps((F), (IX), (V), 4)
+    #elif defined(FDTD_MIXED)
+      #define SRC8_VEC     __m512d
+      #define SRC8_LOAD(P) _mm512_cvtps_pd(_mm256_loadu_ps(P))
+      #define SRC8_ADD     _mm512_add_pd
+      #define SRC8_MUL     _mm512_mul_pd
+      #define SRC8_TABLE(T, IX)                                                \
+        _mm512_cvtps_pd(_mm256_i32gather_ps((T), (IX), 4))
+      #define SRC8_FIELD(F, IX)                                                \
+        _mm512_cvtps_pd(_mm512_i64gather_ps((IX), (F), 4))
+      #define SRC8_SCATTER(F, IX, V)                                           \
+        _mm512_i64scatter_ps((F), (IX), _mm512_cvtpd_ps(V), 4)
+    #else
+      #define SRC8_VEC            __m512d
+      #define SRC8_LOAD           _mm512_loadu_pd
+      #define SRC8_ADD            _mm512_add_pd
+      #define SRC8_MUL            _mm512_mul_pd
+      #define SRC8_TABLE(T, IX)   _mm512_i32gather_pd((IX), (T), 8)
+      #define SRC8_FIELD(F, IX)   _mm512_i64gather_pd((IX), (F), 8)
+      #define SRC8_SCATTER(F, IX, V) _mm512_i64scatter_pd((F), (IX), (V), 8)
+    #endif
+
+__attribute__((CURL_ROW_TARGET("avx512f"))) static void
+source_row_avx512(Real *f, const size_t *restrict offset,
+                  const int *restrict wave, const Real *restrict amp,
+                  const Real *restrict row, int n) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m512i  ix = _mm512_loadu_si512((const void *)(offset + i));
+    __m256i  iw = _mm256_loadu_si256((const void *)(wave + i));
+    SRC8_VEC v  = SRC8_MUL(SRC8_LOAD(amp + i), SRC8_TABLE(row, iw));
+    SRC8_SCATTER(f, ix, SRC8_ADD(SRC8_FIELD(f, ix), v));
+  }
+  for (; i < n; i++)
+    f[offset[i]] = SOURCE_EXPR(f[offset[i]], amp[i], row[wave[i]]);
+}
+  #endif
+#endif
+
+static SimdLevel simd_detect(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f"))
+    return SimdAVX512;
+  if (__builtin_cpu_supports("avx2"))
+    return SimdAVX2;
+  if (__builtin_cpu_supports("sse2"))
+    return SimdSSE2;
+#endif
+  return SimdScalar;
+}
+
+/*
+ * Picks the widest kernels not above `want` that the CPU supports. SSE2 has
+ * no gather, so material IDs fall back to the scalar kernel there.
+ */
+static SimdLevel curl_row_select(SimdLevel want, Grid *grid) {
+  SimdLevel have = simd_detect();
+  SimdLevel use  = (want == SimdAuto || want > have) ? have : want;
+  bool      wide = grid->mat_width == 2;
+
+  grid->curl_row_mat = wide ? curl_row_m16_scalar : curl_row_m8_scalar;
+  grid->source_row   = source_row_scalar;
+
+  switch (use) {
+#if defined(__x86_64__) || defined(__i386__)
+  case SimdAVX512:
+    grid->curl_row       = curl_row_avx512;
+    grid->curl_row_const = curl_row_const_avx512;
+    grid->curl_row_mat   = wide ? curl_row_m16_avx512 : curl_row_m8_avx512;
+    grid->mur_row        = mur_row_avx512;
+    grid->pml_row        = pml_row_avx512;
+  #if defined(__x86_64__)
+    grid->source_row = source_row_avx512;
+  #endif
+    return use;
+  case SimdAVX2:
+    grid->curl_row       = curl_row_avx2;
+    grid->curl_row_const = curl_row_const_avx2;
+    grid->curl_row_mat   = wide ? curl_row_m16_avx2 : curl_row_m8_avx2;
+    grid->mur_row        = mur_row_avx2;
+    grid->pml_row        = pml_row_avx2;
+    return use;
+  case SimdSSE2:
+    grid->curl_row       = curl_row_sse2;
+    grid->curl_row_const = curl_row_const_sse2;
+    grid->mur_row        = mur_row_sse2;
+    grid->pml_row        = pml_row_sse2;
+    return use;
+#endif
+  default:
+    grid->curl_row       = curl_row_scalar;
+    grid->curl_row_const = curl_row_const_scalar;
+    grid->mur_row        = mur_row_scalar;
+    grid->pml_row        = pml_row_scalar;
+    return SimdScalar;
+  }
+}
+
+const char *simd_name(SimdLevel level) {
+  switch (level) {
+  case SimdAuto:
+    return "auto";
+  case SimdScalar:
+    return "scalar";
+  case SimdSSE2:
+    return "sse2";
+  case SimdAVX2:
+    return "avx2";
+  case SimdAVX512:
+    return "avx512";
+  default:
+    NOB_UNREACHABLE("simd_name");
   }
+}
+
+/*
+ * 3D slab engine. The x range of the grid is split into one slab per worker;
+ * the workers stay parked on a barrier between calls so updateH/updateE only
+ * pay two barrier crossings per phase. Each cell is computed by exactly the
+ * same expression as the serial loops, so results are bit-identical for any
+ * worker count.
+ */
+typedef void (*SlabJob)(Grid *grid, Box3d slab);
+typedef void (*PoolJob)(Grid *grid, int worker, int count, void *ctx);
+
+typedef struct {
+  ThreadPool *pool;
+  int         id;
+} PoolWorker;
+
+struct ThreadPool {
+  int               count;
+  pthread_t        *threads;
+  PoolWorker       *workers;
+  Box3d            *slabs;
+  pthread_barrier_t start, done;
+  Grid             *grid;
+  PoolJob           job;
+  void             *ctx;
+  bool              quit;
+};
+
+static void *_pool_worker(void *arg) {
+  PoolWorker *w    = (PoolWorker *)arg;
+  ThreadPool *pool = w->pool;
+
+  for (;;) {
+    pthread_barrier_wait(&pool->start);
+    if (pool->quit)
+      break;
+    pool->job(pool->grid, w->id, pool->count, pool->ctx);
+    pthread_barrier_wait(&pool->done);
+  }
+
+  return NULL;
+}
+
+static ThreadPool *pool_create(Grid *grid, int count) {
+  ThreadPool *pool;
+  int         sx = grid->param.sizeX;
+
+  if (count > sx)
+    count = sx;
+
+  CALLOC(pool, ThreadPool, 1);
+  CALLOC(pool->threads, pthread_t, count);
+  CALLOC(pool->workers, PoolWorker, count);
+  CALLOC(pool->slabs, Box3d, count);
+  pool->count = count;
+  pool->grid  = grid;
+
+  for (int i = 0; i < count; ++i) {
+    pool->slabs[i] = (Box3d){
+        .x0 = (int)((long long)sx * i / count),
+        .x1 = (int)((long long)sx * (i + 1) / count),
+        .y0 = 0,
+        .y1 = grid->param.sizeY,
+        .z0 = 0,
+        .z1 = grid->param.sizeZ,
+    };
+  }
+
+  pthread_barrier_init(&pool->start, NULL, (unsigned)count);
+  pthread_barrier_init(&pool->done, NULL, (unsigned)count);
+
+  // Worker 0 is the calling thread.
+  for (int i = 1; i < count; ++i) {
+    pool->workers[i] = (PoolWorker){.pool = pool, .id = i};
+    if (pthread_create(&pool->threads[i], NULL, _pool_worker,
+                       &pool->workers[i]) != 0) {
+      fprintf(stderr, "[ERROR] Failed to start worker %d.\n", i);
+      abort();
+    }
+  }
+
+  return pool;
+}
+
+static void pool_destroy(ThreadPool *pool) {
+  if (!pool)
+    return;
+
+  pool->quit = true;
+  pthread_barrier_wait(&pool->start);
+  for (int i = 1; i < pool->count; ++i)
+    pthread_join(pool->threads[i], NULL);
+
+  pthread_barrier_destroy(&pool->start);
+  pthread_barrier_destroy(&pool->done);
+  free(pool->threads);
+  free(pool->workers);
+  free(pool->slabs);
+  free(pool);
+}
+
+// Runs job on every worker (or once, inline, without a pool) and waits.
+static void pool_run(Grid *grid, PoolJob job, void *ctx) {
+  ThreadPool *pool = grid->pool;
+
+  if (!pool) {
+    job(grid, 0, 1, ctx);
+    return;
+  }
+
+  pool->job = job;
+  pool->ctx = ctx;
+  pthread_barrier_wait(&pool->start);
+  job(grid, 0, pool->count, ctx);
+  pthread_barrier_wait(&pool->done);
+}
+
+typedef struct {
+  SlabJob job;
+} SlabRun;
+
+static void _slab_job(Grid *grid, int worker, int count, void *ctx) {
+  (void)count;
+  SlabJob job  = ((SlabRun *)ctx)->job;
+  Box3d   slab = grid->pool ? grid->pool->slabs[worker] : _grid_box(grid);
+
+  if (grid->param.activeRegion)
+    slab = _box_clip(slab, grid->active);
+  if (!_box_empty(slab))
+    job(grid, slab);
+}
+
+static void grid_run_3d(Grid *grid, SlabJob job) {
+  pool_run(grid, _slab_job, &(SlabRun){.job = job});
+}
+
+/*
+ * All arrays of a grid live in one GRID_ALIGN aligned arena, each array
+ * starting on its own cache line. In 3D the six components also share one
+ * padded layout: every component is stored as a sizeX x sizeY x sy box with
+ * sy = sizeZ rounded up to whole cache lines (plus padLines more), so every
+ * row starts on a cache line and a neighbour along x, y or z is the same
+ * offset sx, sy or 1 in every component. Cells outside a component's Yee
+ * extent are never updated and stay zero.
+ *
+ * With interleaved the same rows are stored array-of-structures: the rows of
+ * one (x, y) column form a group, ex ey ez hx hy hz, then the six self and
+ * the six curl coefficients when the grid has them, so sy is the size of a
+ * group and each array pointer is the first group plus its row offset. An ez
+ * update then reads hy, hx and its coefficients from one or two adjacent
+ * groups instead of five to nine separate streams. Material IDs get their
+ * own block of six-row groups with the same offsets in mat_width units.
+ *
+ * The arena is not touched when it is allocated. Pages are placed on the
+ * NUMA node of the thread that first writes them, so grid_init zeroes and
+ * fills every per-cell array through the pool: each worker initialises
+ * exactly the x slab it later updates. With hugePages the arena is aligned
+ * to 2 MB and marked MADV_HUGEPAGE; pinning the workers themselves is left
+ * to numactl/taskset. grid_page_report shows where the pages ended up.
+ */
+typedef struct {
+  void **ptr;
+  size_t bytes;
+} ArenaSlot;
+
+// One per-cell array for first touch: count elements of size bytes each.
+typedef struct {
+  void  *ptr;
+  size_t count; // a multiple of sizeX in 3D
+  size_t size;
+  Real   value; // 0 zero-fills
+} CellArray;
+
+#define CELL_ARRAYS 24
+
+static inline size_t _max_size(size_t a, size_t b) { return a > b ? a : b; }
+
+static size_t _align_up(size_t n, size_t align) {
+  return (n + align - 1) / align * align;
+}
+
+// Carves aligned arrays out of one allocation; empty slots get NULL.
+static bool arena_alloc(Grid *grid, ArenaSlot *slots, size_t count,
+                        bool huge) {
+  size_t align = huge ? GRID_HUGE_ALIGN : GRID_ALIGN;
+  size_t total = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (slots[i].bytes > SIZE_MAX - total - GRID_HUGE_ALIGN)
+      return false;
+    total += _align_up(slots[i].bytes, GRID_ALIGN);
+  }
+  total = _align_up(total ? total : 1, align);
+
+  char *base = aligned_alloc(align, total);
+  if (!base) {
+    fprintf(stderr, "[ERROR] Allocation failed for grid arena.\n");
+    abort();
+  }
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+  if (huge && madvise(base, total, MADV_HUGEPAGE) != 0)
+    fprintf(stderr, "[grid_init] MADV_HUGEPAGE failed, using base pages\n");
+#endif
+
+  size_t offset = 0;
+  for (size_t i = 0; i < count; ++i) {
+    *slots[i].ptr = slots[i].bytes ? base + offset : NULL;
+    offset += _align_up(slots[i].bytes, GRID_ALIGN);
+  }
+  grid->arena      = base;
+  grid->arena_size = total;
+  return true;
+}
+
+/*
+ * Fields, coefficient arrays and material IDs of a grid with n[] cells per
+ * component (ex, ey, ez, hx, hy, hz); arrays that are not allocated get a
+ * count of 0.
+ */
+static void _cell_arrays(Grid *grid, const size_t n[6], CellArray *out) {
+  size_t    rs = sizeof(Real), w = (size_t)grid->mat_width;
+  CellArray all[CELL_ARRAYS] = {
+      {grid->ex, n[0], rs, 0},          {grid->ey, n[1], rs, 0},
+      {grid->ez, n[2], rs, 0},          {grid->hx, n[3], rs, 0},
+      {grid->hy, n[4], rs, 0},          {grid->hz, n[5], rs, 0},
+      {grid->cexe, n[0], rs, 1},        {grid->cexh, n[0], rs, grid->ce},
+      {grid->ceye, n[1], rs, 1},        {grid->ceyh, n[1], rs, grid->ce},
+      {grid->ceze, n[2], rs, 1},        {grid->cezh, n[2], rs, grid->ce},
+      {grid->chxh, n[3], rs, 1},        {grid->chxe, n[3], rs, grid->ch},
+      {grid->chyh, n[4], rs, 1},        {grid->chye, n[4], rs, grid->ch},
+      {grid->chzh, n[5], rs, 1},        {grid->chze, n[5], rs, grid->ch},
+      {grid->mex, n[0], w, 0},          {grid->mey, n[1], w, 0},
+      {grid->mez, n[2], w, 0},          {grid->mhx, n[3], w, 0},
+      {grid->mhy, n[4], w, 0},          {grid->mhz, n[5], w, 0},
+  };
+
+  for (size_t i = 0; i < CELL_ARRAYS; ++i) {
+    out[i] = all[i];
+    if (!out[i].ptr)
+      out[i].count = 0;
+  }
+}
+
+// Points the arrays of an interleaved grid at their rows of the groups that
+// start at ex and mex.
+static void _interleave(Grid *grid) {
+  Real    *f  = grid->ex;
+  uint8_t *id = grid->mex;
+  size_t   r = grid->row, w = (size_t)grid->mat_width;
+
+  grid->ey = f + 1 * r;
+  grid->ez = f + 2 * r;
+  grid->hx = f + 3 * r;
+  grid->hy = f + 4 * r;
+  grid->hz = f + 5 * r;
+  if (!grid->param.uniform && grid->param.materials == 0) {
+    grid->cexe = f + 6 * r;
+    grid->ceye = f + 7 * r;
+    grid->ceze = f + 8 * r;
+    grid->chxh = f + 9 * r;
+    grid->chyh = f + 10 * r;
+    grid->chzh = f + 11 * r;
+    grid->cexh = f + 12 * r;
+    grid->ceyh = f + 13 * r;
+    grid->cezh = f + 14 * r;
+    grid->chxe = f + 15 * r;
+    grid->chye = f + 16 * r;
+    grid->chze = f + 17 * r;
+  }
+  if (id) {
+    grid->mey = id + 1 * r * w;
+    grid->mez = id + 2 * r * w;
+    grid->mhx = id + 3 * r * w;
+    grid->mhy = id + 4 * r * w;
+    grid->mhz = id + 5 * r * w;
+  }
+}
 
-  FREE(g->hx);
-  FREE(g->chxe);
-  FREE(g->chxh);
+// Element range of a per-cell array that belongs to worker's x slab.
+static void _cell_range(Grid *grid, int worker, const CellArray *a,
+                        size_t *lo, size_t *hi) {
+  *lo = 0;
+  *hi = a->count;
+  if (!grid->pool)
+    return;
+
+  Box3d  slab = grid->pool->slabs[worker];
+  size_t row  = a->count / (size_t)grid->param.sizeX;
+  *lo         = row * (size_t)slab.x0;
+  *hi         = row * (size_t)slab.x1;
+}
+
+static void _cell_fill(const CellArray *a, size_t lo, size_t hi) {
+  if (a->value == 0) {
+    memset((char *)a->ptr + lo * a->size, 0, (hi - lo) * a->size);
+    return;
+  }
+  for (size_t j = lo; j < hi; ++j)
+    ((Real *)a->ptr)[j] = a->value;
+}
+
+// Interleaved rows are not contiguous, so they are filled one at a time.
+static void _first_touch_job(Grid *grid, int worker, int count, void *ctx) {
+  (void)count;
+  CellArray *arrays = (CellArray *)ctx;
+  Box3d      slab =
+      grid->pool ? grid->pool->slabs[worker] : _grid_box(grid);
 
-  FREE(g->hy);
-  FREE(g->chye);
-  FREE(g->chyh);
+  for (size_t i = 0; i < CELL_ARRAYS; ++i) {
+    CellArray *a = &arrays[i];
+    size_t     lo, hi;
 
-  FREE(g->hz);
-  FREE(g->chze);
-  FREE(g->chzh);
+    if (!a->count)
+      continue;
+    if (!grid->param.interleaved) {
+      _cell_range(grid, worker, a, &lo, &hi);
+      _cell_fill(a, lo, hi);
+      continue;
+    }
+    for (int m = slab.x0; m < slab.x1; ++m)
+      for (int n = 0; n < grid->param.sizeY; ++n) {
+        lo = IDX3(m, n, 0, grid->sx, grid->sy);
+        _cell_fill(a, lo, lo + grid->row);
+      }
+  }
+}
+
+static void boundary_free_3d(BoundaryParam3d *param);
+
+bool grid_free(Grid *g) {
+  if (!g) {
+    return false;
+  }
 
-  FREE(g->ex);
-  FREE(g->cexe);
-  FREE(g->cexh);
+  free(g->arena);
+  g->arena      = NULL;
+  g->arena_size = 0;
+  g->hx = g->chxh = g->chxe = NULL;
+  g->hy = g->chyh = g->chye = NULL;
+  g->hz = g->chzh = g->chze = NULL;
+  g->ex = g->cexe = g->cexh = NULL;
+  g->ey = g->ceye = g->ceyh = NULL;
+  g->ez = g->ceze = g->cezh = NULL;
+  g->mex = g->mey = g->mez = NULL;
+  g->mhx = g->mhy = g->mhz = NULL;
+  g->mat_cee = g->mat_ceh = g->mat_chh = g->mat_che = NULL;
+  g->mat_width = 0;
+  g->sx = g->sy = g->row = 0;
+  g->active = (Box3d){0};
+  g->fixed = -1;
+  if (g->abc)
+    boundary_free_3d(g->abc);
+  g->abc  = NULL;
+  g->tfsf = NULL;
+  FREE(g->wires);
+  g->wire_count = 0;
 
-  FREE(g->ey);
-  FREE(g->ceye);
-  FREE(g->ceyh);
+  pool_destroy(g->pool);
+  g->pool = NULL;
 
-  FREE(g->ez);
-  FREE(g->ceze);
-  FREE(g->cezh);
+#ifdef FDTD_PROFILE
+  prof_report(g, stderr);
+#endif
+  memset(g->prof, 0, sizeof(g->prof));
 
   g->time = 0;
   g->type = OneDimension;
@@ -173,6 +1437,8 @@ bool grid_free(Grid *g) {
   return true;
 }
 
+static int fixed_select(const Grid *grid);
+
 bool grid_init(Grid *grid, GridType type, GridParameter param) {
   if (!grid) {
     return false;
@@ -189,11 +1455,19 @@ bool grid_init(Grid *grid, GridType type, GridParameter param) {
   size_t sz   = (size_t)p.sizeZ;
   size_t sx_1 = sx ? sx - 1 : 0;
   size_t sy_1 = sy ? sy - 1 : 0;
-  size_t sz_1 = sz ? sz - 1 : 0;
 
   size_t ex_cnt = 0, ey_cnt = 0, ez_cnt = 0;
   size_t hx_cnt = 0, hy_cnt = 0, hz_cnt = 0;
 
+  grid->param.activeRegion = p.activeRegion && type == ThreeDimension;
+  grid->param.interleaved  = p.interleaved && type == ThreeDimension;
+  grid->active             = (Box3d){0};
+  grid->abc                = NULL;
+  grid->tfsf               = NULL;
+  grid->wires              = NULL;
+  grid->wire_count         = 0;
+
+  grid->sx = grid->sy = grid->row = 0;
   switch (type) {
   case OneDimension:
     ez_cnt = sx;
@@ -215,69 +1489,118 @@ bool grid_init(Grid *grid, GridType type, GridParameter param) {
     if (!_mul_2_safe(sx_1, sy, &ey_cnt))
       goto overflow;
     break;
-  case ThreeDimension:
-    if (!_mul_3_safe(sx, sy_1, sz_1, &ex_cnt))
-      goto overflow;
-    if (!_mul_3_safe(sx_1, sy, sz_1, &ey_cnt))
-      goto overflow;
-    if (!_mul_3_safe(sx_1, sy_1, sz, &ez_cnt))
-      goto overflow;
-    if (!_mul_3_safe(sx_1, sy, sz, &hx_cnt))
+  case ThreeDimension: {
+    size_t line = GRID_ALIGN / sizeof(Real);
+    size_t pad  = p.padLines > 0 ? (size_t)p.padLines : 0;
+    size_t rows = 1;
+
+    if (p.interleaved)
+      rows = p.uniform || p.materials > 0 ? 6 : 18;
+
+    grid->row = ((sz + line - 1) / line + pad) * line;
+    if (!_mul_2_safe(rows, grid->row, &grid->sy))
       goto overflow;
-    if (!_mul_3_safe(sx, sy_1, sz, &hy_cnt))
+    if (!_mul_2_safe(sy, grid->sy, &grid->sx))
       goto overflow;
-    if (!_mul_3_safe(sx, sy, sz_1, &hz_cnt))
+    if (!_mul_2_safe(sx, grid->sx, &ex_cnt))
       goto overflow;
+    ey_cnt = ez_cnt = hx_cnt = hy_cnt = hz_cnt = ex_cnt;
     break;
+  }
   default:
     NOB_UNREACHABLE("type");
   }
 
-  CALLOC(grid->ex, double, ex_cnt);
-  CALLOC(grid->cexe, double, ex_cnt);
-  CALLOC(grid->cexh, double, ex_cnt);
-  CALLOC(grid->ey, double, ey_cnt);
-  CALLOC(grid->ceye, double, ey_cnt);
-  CALLOC(grid->ceyh, double, ey_cnt);
-  CALLOC(grid->ez, double, ez_cnt);
-  CALLOC(grid->ceze, double, ez_cnt);
-  CALLOC(grid->cezh, double, ez_cnt);
-  CALLOC(grid->hx, double, hx_cnt);
-  CALLOC(grid->chxh, double, hx_cnt);
-  CALLOC(grid->chxe, double, hx_cnt);
-  CALLOC(grid->hy, double, hy_cnt);
-  CALLOC(grid->chyh, double, hy_cnt);
-  CALLOC(grid->chye, double, hy_cnt);
-  CALLOC(grid->hz, double, hz_cnt);
-  CALLOC(grid->chzh, double, hz_cnt);
-  CALLOC(grid->chze, double, hz_cnt);
+  grid->ce = p.cdtds * p.imp0;
+  grid->ch = p.cdtds / p.imp0;
 
-  for (size_t i = 0; i < ex_cnt; ++i) {
-    grid->cexe[i] = 1.0;
-    grid->cexh[i] = p.cdtds * p.imp0;
-  }
-  for (size_t i = 0; i < ey_cnt; ++i) {
-    grid->ceye[i] = 1.0;
-    grid->ceyh[i] = p.cdtds * p.imp0;
-  }
-  for (size_t i = 0; i < ez_cnt; ++i) {
-    grid->ceze[i] = 1.0;
-    grid->cezh[i] = p.cdtds * p.imp0;
+  /*
+   * A uniform 3D grid runs on grid->ce/ch alone and a material grid on one
+   * small ID per cell and component plus the mat_* tables; either way the
+   * coefficient arrays stay NULL. Material IDs take precedence.
+   */
+  grid->param.materials =
+      type == ThreeDimension ? _max_int(p.materials, 0) : 0;
+  if (grid->param.materials > 65536) {
+    fprintf(stderr, "[grid_init] At most 65536 materials, got %d\n",
+            p.materials);
+    return false;
   }
+  grid->param.uniform = p.uniform && type == ThreeDimension;
 
-  for (size_t i = 0; i < hx_cnt; ++i) {
-    grid->chxh[i] = 1.0;
-    grid->chxe[i] = p.cdtds / p.imp0;
-  }
-  for (size_t i = 0; i < hy_cnt; ++i) {
-    grid->chyh[i] = 1.0;
-    grid->chye[i] = p.cdtds / p.imp0;
-  }
-  for (size_t i = 0; i < hz_cnt; ++i) {
-    grid->chzh[i] = 1.0;
-    grid->chze[i] = p.cdtds / p.imp0;
+  size_t nm    = (size_t)grid->param.materials;
+  size_t w     = nm == 0 ? 0 : nm <= 256 ? 1 : 2;
+  bool   coeff = !grid->param.uniform && nm == 0;
+  size_t most  = _max_size(_max_size(ex_cnt, ey_cnt), ez_cnt);
+
+  most = _max_size(most, _max_size(_max_size(hx_cnt, hy_cnt), hz_cnt));
+  if (most > SIZE_MAX / sizeof(Real))
+    goto overflow;
+  grid->mat_width = (int)w;
+
+  ArenaSlot slots[] = {
+      {(void **)&grid->ex, ex_cnt * sizeof(Real)},
+      {(void **)&grid->ey, ey_cnt * sizeof(Real)},
+      {(void **)&grid->ez, ez_cnt * sizeof(Real)},
+      {(void **)&grid->hx, hx_cnt * sizeof(Real)},
+      {(void **)&grid->hy, hy_cnt * sizeof(Real)},
+      {(void **)&grid->hz, hz_cnt * sizeof(Real)},
+      {(void **)&grid->cexe, coeff ? ex_cnt * sizeof(Real) : 0},
+      {(void **)&grid->cexh, coeff ? ex_cnt * sizeof(Real) : 0},
+      {(void **)&grid->ceye, coeff ? ey_cnt * sizeof(Real) : 0},
+      {(void **)&grid->ceyh, coeff ? ey_cnt * sizeof(Real) : 0},
+      {(void **)&grid->ceze, coeff ? ez_cnt * sizeof(Real) : 0},
+      {(void **)&grid->cezh, coeff ? ez_cnt * sizeof(Real) : 0},
+      {(void **)&grid->chxh, coeff ? hx_cnt * sizeof(Real) : 0},
+      {(void **)&grid->chxe, coeff ? hx_cnt * sizeof(Real) : 0},
+      {(void **)&grid->chyh, coeff ? hy_cnt * sizeof(Real) : 0},
+      {(void **)&grid->chye, coeff ? hy_cnt * sizeof(Real) : 0},
+      {(void **)&grid->chzh, coeff ? hz_cnt * sizeof(Real) : 0},
+      {(void **)&grid->chze, coeff ? hz_cnt * sizeof(Real) : 0},
+      {(void **)&grid->mex, ex_cnt * w},
+      {(void **)&grid->mey, ey_cnt * w},
+      {(void **)&grid->mez, ez_cnt * w},
+      {(void **)&grid->mhx, hx_cnt * w},
+      {(void **)&grid->mhy, hy_cnt * w},
+      {(void **)&grid->mhz, hz_cnt * w},
+      {(void **)&grid->mat_cee, nm * sizeof(Real)},
+      {(void **)&grid->mat_ceh, nm * sizeof(Real)},
+      {(void **)&grid->mat_chh, nm * sizeof(Real)},
+      {(void **)&grid->mat_che, nm * sizeof(Real)},
+  };
+  // Interleaved, ex and mex are sized for whole groups and carry the rest.
+  for (size_t i = 0; grid->param.interleaved && i < CELL_ARRAYS; ++i)
+    if (slots[i].ptr != (void **)&grid->ex &&
+        slots[i].ptr != (void **)&grid->mex)
+      slots[i].bytes = 0;
+  if (!arena_alloc(grid, slots, NOB_ARRAY_LEN(slots), p.hugePages))
+    goto overflow;
+  if (grid->param.interleaved)
+    _interleave(grid);
+
+  // Pages are placed by first touch, so the workers have to exist first.
+  grid->pool = NULL;
+  if (type == ThreeDimension && p.threads > 1)
+    grid->pool = pool_create(grid, p.threads);
+
+  size_t    counts[6] = {ex_cnt, ey_cnt, ez_cnt, hx_cnt, hy_cnt, hz_cnt};
+  CellArray arrays[CELL_ARRAYS];
+  _cell_arrays(grid, counts, arrays);
+  pool_run(grid, _first_touch_job, arrays);
+
+  for (size_t i = 0; i < nm; ++i) {
+    grid->mat_cee[i] = 1.0;
+    grid->mat_ceh[i] = grid->ce;
+    grid->mat_chh[i] = 1.0;
+    grid->mat_che[i] = grid->ch;
   }
 
+  grid->simd  = curl_row_select(p.simd, grid);
+  grid->fixed = fixed_select(grid);
+
+  if (p.pageReport)
+    grid_page_report(grid, stderr);
+
   return true;
 
 overflow:
@@ -285,32 +1608,1863 @@ overflow:
   return false;
 }
 
-void updateH(Grid *grid) {
-  int mm, nn, pp;
-  switch (grid->type) {
-  case OneDimension:
-    for (mm = 0; mm < (grid->param.sizeX - 1); mm++) {
-      grid->hy[mm] = grid->chyh[mm] * grid->hy[mm] +
-                     grid->chye[mm] * (grid->ez[mm + 1] - grid->ez[mm]);
-    }
-    return;
+#if defined(__linux__) && defined(SYS_move_pages)
+  #define PAGE_NODES 64
 
-  case TwoDimensionMagnetic:
-    for (mm = 0; mm < grid->param.sizeX; mm++) {
-      for (nn = 0; nn < (grid->param.sizeY - 1); nn++) {
-        grid->hx[IDX2(mm, nn, (grid->param.sizeY - 1))] =
-            grid->chxh[IDX2(mm, nn, (grid->param.sizeY - 1))] *
-                grid->hx[IDX2(mm, nn, (grid->param.sizeY - 1))] -
-            grid->chxe[IDX2(mm, nn, (grid->param.sizeY - 1))] *
-                (grid->ez[IDX2(mm, nn + 1, (grid->param.sizeY))] -
-                 grid->ez[IDX2(mm, nn, (grid->param.sizeY))]);
-        // Hx(grid, mm, nn) = Chxh(grid, mm, nn) * Hx(grid, mm, nn) - Chxe(grid,
-        // mm, nn) * (Ez(grid, mm, nn + 1) - Ez(grid, mm, nn));
-      }
+// Adds the NUMA node of every page in [lo, hi) to nodes[0..PAGE_NODES].
+static void _page_nodes(const char *lo, const char *hi, size_t page,
+                        size_t *nodes) {
+  void     *pages[512];
+  int       status[512];
+  uintptr_t at = (uintptr_t)lo / page * page;
+
+  while (at < (uintptr_t)hi) {
+    unsigned long k = 0;
+    for (; k < 512 && at < (uintptr_t)hi; ++k, at += page)
+      pages[k] = (void *)at;
+
+    // With no target nodes move_pages only reports where each page lives.
+    if (syscall(SYS_move_pages, 0, k, pages, NULL, status, 0) != 0) {
+      nodes[PAGE_NODES] += k;
+      continue;
     }
-    for (mm = 0; mm < (grid->param.sizeX - 1); mm++) {
-      for (nn = 0; nn < grid->param.sizeY; nn++) {
-        grid->hy[IDX2(mm, nn, (grid->param.sizeY))] =
+    for (unsigned long i = 0; i < k; ++i)
+      nodes[status[i] >= 0 && status[i] < PAGE_NODES ? status[i]
+                                                     : PAGE_NODES]++;
+  }
+}
+
+// AnonHugePages of every mapping that overlaps [base, base + bytes).
+static size_t _huge_kb(const void *base, size_t bytes) {
+  FILE *f = fopen("/proc/self/smaps", "r");
+  if (!f)
+    return 0;
+
+  uintptr_t b = (uintptr_t)base, e = b + bytes;
+  char      line[256];
+  bool      inside = false;
+  size_t    total  = 0;
+  while (fgets(line, sizeof(line), f)) {
+    unsigned long lo, hi;
+    size_t        kb;
+    if (sscanf(line, "%lx-%lx ", &lo, &hi) == 2)
+      inside = lo < e && hi > b;
+    else if (inside && sscanf(line, "AnonHugePages: %zu kB", &kb) == 1)
+      total += kb;
+  }
+
+  fclose(f);
+  return total;
+}
+#endif
+
+/*
+ * Prints how many pages of every worker's x slab sit on each NUMA node,
+ * summed over all per-cell arrays, and how much of the arena is backed by
+ * transparent huge pages. Pages straddling two slabs count for both; grids
+ * other than 3D report the whole arena as one row. "other" counts pages the
+ * kernel could not place (not yet touched or no NUMA support).
+ */
+void grid_page_report(Grid *grid, FILE *out) {
+#if defined(__linux__) && defined(SYS_move_pages)
+  size_t  page    = (size_t)sysconf(_SC_PAGESIZE);
+  int     workers = grid->pool ? grid->pool->count : 1;
+  size_t *nodes;
+  CALLOC(nodes, size_t, (size_t)workers * (PAGE_NODES + 1));
+
+  size_t    all  = (size_t)grid->param.sizeX * grid->sx;
+  size_t    n[6] = {all, all, all, all, all, all};
+  CellArray arrays[CELL_ARRAYS];
+  _cell_arrays(grid, n, arrays);
+
+  int used = 1;
+  for (int w = 0; w < workers; ++w) {
+    size_t *row = &nodes[(size_t)w * (PAGE_NODES + 1)];
+
+    if (grid->type != ThreeDimension) {
+      const char *base = (const char *)grid->arena;
+      _page_nodes(base, base + grid->arena_size, page, row);
+    }
+    for (size_t i = 0; grid->type == ThreeDimension && i < CELL_ARRAYS; ++i) {
+      const char *base = (const char *)arrays[i].ptr;
+      size_t      lo, hi;
+
+      // Interleaved, the blocks at ex and mex hold every other array.
+      if (!arrays[i].count ||
+          (grid->param.interleaved && arrays[i].ptr != grid->ex &&
+           arrays[i].ptr != grid->mex))
+        continue;
+      _cell_range(grid, w, &arrays[i], &lo, &hi);
+      _page_nodes(base + lo * arrays[i].size, base + hi * arrays[i].size,
+                  page, row);
+    }
+    for (int k = 0; k < PAGE_NODES; ++k)
+      if (row[k])
+        used = _max_int(used, k + 1);
+  }
+
+  fprintf(out,
+          "[grid_page_report] arena %.1f MiB, %zu B pages, %zu kB in huge "
+          "pages\n",
+          grid->arena_size / 1048576.0, page,
+          _huge_kb(grid->arena, grid->arena_size));
+  fprintf(out, "%6s %13s", "worker", "x range");
+  for (int k = 0; k < used; ++k) {
+    char name[16];
+    snprintf(name, sizeof(name), "node%d", k);
+    fprintf(out, " %9s", name);
+  }
+  fprintf(out, " %9s\n", "other");
+
+  for (int w = 0; w < workers; ++w) {
+    size_t *row   = &nodes[(size_t)w * (PAGE_NODES + 1)];
+    Box3d   slab  = grid->pool ? grid->pool->slabs[w]
+                               : (Box3d){.x0 = 0, .x1 = grid->param.sizeX};
+    char    range[32];
+
+    snprintf(range, sizeof(range), "[%d, %d)", slab.x0, slab.x1);
+    fprintf(out, "%6d %13s", w, range);
+    for (int k = 0; k < used; ++k)
+      fprintf(out, " %9zu", row[k]);
+    fprintf(out, " %9zu\n", row[PAGE_NODES]);
+  }
+
+  free(nodes);
+#else
+  (void)grid;
+  fprintf(out, "[grid_page_report] Page placement needs Linux move_pages\n");
+#endif
+}
+
+// Walks rows, so padding and interleaved neighbours are never mixed in.
+static bool _coeff_uniform(const Grid *grid, const Real *cf, const Real *cg,
+                           Real c) {
+  for (int m = 0; m < grid->param.sizeX; ++m)
+    for (int n = 0; n < grid->param.sizeY; ++n) {
+      size_t i0 = IDX3(m, n, 0, grid->sx, grid->sy);
+      for (size_t i = i0; i < i0 + grid->row; ++i)
+        if (cf[i] != 1.0 || cg[i] != c)
+          return false;
+    }
+  return true;
+}
+/*
+ * Checks whether every coefficient of a 3D grid still has its free-space
+ * value and, if so, drops the arrays and switches the grid to the scalar
+ * kernels. Their arena space is only returned by grid_free, but they are no
+ * longer streamed. Call it after setting up materials and before stepping.
+ * Returns true when the grid runs uniform afterwards.
+ */
+bool grid_detect_uniform(Grid *grid) {
+  if (!grid || grid->type != ThreeDimension || grid->param.materials > 0)
+    return false;
+  if (grid->param.uniform)
+    return true;
+
+  // Padding cells were filled with free-space values as well. Interleaved
+  // groups keep the coefficient rows; the sweeps just stop reading them.
+  if (!_coeff_uniform(grid, grid->cexe, grid->cexh, grid->ce) ||
+      !_coeff_uniform(grid, grid->ceye, grid->ceyh, grid->ce) ||
+      !_coeff_uniform(grid, grid->ceze, grid->cezh, grid->ce) ||
+      !_coeff_uniform(grid, grid->chxh, grid->chxe, grid->ch) ||
+      !_coeff_uniform(grid, grid->chyh, grid->chye, grid->ch) ||
+      !_coeff_uniform(grid, grid->chzh, grid->chze, grid->ch))
+    return false;
+
+  grid->cexe = grid->cexh = grid->ceye = grid->ceyh = NULL;
+  grid->ceze = grid->cezh = grid->chxh = grid->chxe = NULL;
+  grid->chyh = grid->chye = grid->chzh = grid->chze = NULL;
+  grid->param.uniform = true;
+  return true;
+}
+
+// Sets the coefficients of material `id` in a material-ID grid.
+bool grid_material_set(Grid *grid, int id, double cee, double ceh, double chh,
+                       double che) {
+  if (!grid || id < 0 || id >= grid->param.materials)
+    return false;
+
+  grid->mat_cee[id] = cee;
+  grid->mat_ceh[id] = ceh;
+  grid->mat_chh[id] = chh;
+  grid->mat_che[id] = che;
+  return true;
+}
+
+static void _material_fill(Grid *grid, uint8_t *ids, Box3d box, int X, int Y,
+                           int Z, int id) {
+  int x0 = _max_int(box.x0, 0), x1 = _min_int(box.x1, X);
+  int y0 = _max_int(box.y0, 0), y1 = _min_int(box.y1, Y);
+  int z0 = _max_int(box.z0, 0), z1 = _min_int(box.z1, Z);
+
+  for (int mm = x0; mm < x1; mm++) {
+    for (int nn = y0; nn < y1; nn++) {
+      for (int pp = z0; pp < z1; pp++) {
+        size_t i = IDX3(mm, nn, pp, grid->sx, grid->sy);
+        if (grid->mat_width == 2)
+          ((uint16_t *)ids)[i] = (uint16_t)id;
+        else
+          ids[i] = (uint8_t)id;
+      }
+    }
+  }
+}
+
+/*
+ * Assigns material `id` to every component sample whose index lies in `box`
+ * (clipped to each component's extent) in a material-ID grid.
+ */
+bool grid_material_box(Grid *grid, Box3d box, int id) {
+  if (!grid || id < 0 || id >= grid->param.materials)
+    return false;
+
+  int X = grid->param.sizeX, Y = grid->param.sizeY, Z = grid->param.sizeZ;
+
+  _material_fill(grid, grid->mex, box, X - 1, Y, Z, id);
+  _material_fill(grid, grid->mey, box, X, Y - 1, Z, id);
+  _material_fill(grid, grid->mez, box, X, Y, Z - 1, id);
+  _material_fill(grid, grid->mhx, box, X, Y - 1, Z - 1, id);
+  _material_fill(grid, grid->mhy, box, X - 1, Y, Z - 1, id);
+  _material_fill(grid, grid->mhz, box, X - 1, Y - 1, Z, id);
+  return true;
+}
+
+/*
+ * Active-region mode (GridParameter.activeRegion). A Yee update whose inputs
+ * are all zero leaves its cell exactly zero, and one step moves non-zero
+ * values at most one cell along each axis. grid->active bounds every cell
+ * that may be non-zero; updateH first grows it by one cell per side and then
+ * both phases sweep only that box, so the result is bit-identical to the
+ * full sweep. Anything that writes fields outside the box, typically a
+ * source, has to announce the cells with grid_activate once beforehand. The
+ * box starts empty, so nothing moves until then. grid_step_blocked and
+ * grid_step_fused always sweep the whole grid and mark it all active.
+ */
+void grid_activate(Grid *grid, Box3d box) {
+  if (!grid->param.activeRegion)
+    return;
+
+  box = _box_clip(box, _grid_box(grid));
+  if (_box_empty(box))
+    return;
+  if (_box_empty(grid->active)) {
+    grid->active = box;
+    return;
+  }
+
+  Box3d a = grid->active;
+
+  grid->active = (Box3d){
+      _min_int(a.x0, box.x0), _max_int(a.x1, box.x1), _min_int(a.y0, box.y0),
+      _max_int(a.y1, box.y1), _min_int(a.z0, box.z0), _max_int(a.z1, box.z1),
+  };
+}
+
+static void grid_active_grow(Grid *grid) {
+  Box3d a = grid->active;
+
+  if (_box_empty(a))
+    return;
+  grid->active = _box_clip(
+      (Box3d){a.x0 - 1, a.x1 + 1, a.y0 - 1, a.y1 + 1, a.z0 - 1, a.z1 + 1},
+      _grid_box(grid));
+}
+
+/*
+ * One row of a component update starting at offset `i`. The coefficients
+ * come from the cf/cg arrays, from the material table through the `id`
+ * array, or on a uniform grid from grid->ch/ce, depending on the grid mode.
+ */
+static inline void curl_row_at(Grid *grid, bool magnetic, Real *f,
+                               const Real *cf, const Real *cg,
+                               const uint8_t *id, size_t i, const Real *a1,
+                               const Real *a0, const Real *b1, const Real *b0,
+                               int n) {
+  if (grid->param.materials > 0)
+    grid->curl_row_mat(f + i, id + i * grid->mat_width,
+                       magnetic ? grid->mat_chh : grid->mat_cee,
+                       magnetic ? grid->mat_che : grid->mat_ceh, a1, a0, b1,
+                       b0, n);
+  else if (grid->param.uniform)
+    grid->curl_row_const(f + i, magnetic ? grid->ch : grid->ce, a1, a0, b1,
+                         b0, n);
+  else
+    grid->curl_row(f + i, cf + i, cg + i, a1, a0, b1, b0, n);
+}
+
+/*
+ * Absorbing boundaries, both applied row by row inside the sweeps.
+ *
+ * ABC: first-order Mur on all six faces. Tangential E on a face is never
+ * swept; instead, as soon as a component row next to a face has been
+ * updated, the face row beside it (x and y faces, contiguous along z and run
+ * through grid->mur_row) or the end cells of the row itself (z faces) are
+ * advanced from it while the row is still in L1. Cells on a grid edge have
+ * no swept neighbour across either face and stay zero (PEC).
+ *
+ * cPML: convolutional PML, `layers` cells thick on every face and backed by
+ * the PEC walls. With kappa = 1 the CPML update of a cell is the ordinary
+ * Yee update plus cg * psi for each derivative the layer stretches, where
+ *
+ *   psi = b * psi + a * (f1 - f0)
+ *
+ * so the regular kernels run unchanged on the whole grid and only rows that
+ * cross a layer get the pml_cells correction afterwards: whole rows inside an
+ * x or y slab, and the first and last layers + 1 cells of every row for z.
+ * sigma is graded with the cube of the depth up to the usual optimum
+ * 0.8 (m + 1) / (imp0 dx), which in time-step units is 3.2 cdtds, and a
+ * small CFS alpha falls off towards the wall. The correction is scaled by
+ * the curl coefficient of each cell, like its Yee update, so the layers may
+ * hold any medium the grid does.
+ */
+#define PML_ALPHA 0.01
+
+// Slab slot of index i along an axis of n cells, -1 in the interior.
+static inline int _pml_slot(int i, int n, int s) {
+  return i < s ? i : i >= n - s ? s + i - (n - s) : -1;
+}
+
+static bool pml_init(Grid *grid, BoundaryParam3d *param) {
+  int    N[3] = {grid->param.sizeX, grid->param.sizeY, grid->param.sizeZ};
+  int    L    = param->layers > 0 ? param->layers : 10;
+  size_t s    = (size_t)L + 1, row = grid->row;
+  size_t cells[3];
+
+  for (int ax = 0; ax < 3; ++ax)
+    if (!param->periodic[ax] && N[ax] < 2 * (int)s + 1) {
+      fprintf(stderr, "[boundary_init_3d] %d cPML layers need %d cells\n", L,
+              2 * L + 3);
+      return false;
+    }
+
+  // Every psi array spans the grid except along its axis, where it only
+  // has the two slabs.
+  cells[0] = 2 * s * (size_t)N[1] * row;
+  cells[1] = (size_t)N[0] * 2 * s * row;
+  cells[2] = (size_t)N[0] * N[1] * 2 * s;
+
+  param->layers = L;
+  for (int c = 0; c < 6; ++c)
+    for (int ax = 0; ax < 3; ++ax) {
+      if (ax == c % 3 || param->periodic[ax])
+        continue;
+      CALLOC(param->psi[c][ax], Real, cells[ax]);
+    }
+
+  double smax = 0.8 * 4 * grid->param.cdtds;
+  for (int h = 0; h < 2; ++h)
+    for (int ax = 0; ax < 3; ++ax) {
+      CALLOC(param->pb[h][ax], Real, N[ax]);
+      CALLOC(param->pa[h][ax], Real, N[ax]);
+      for (int i = 0; i < N[ax]; ++i) {
+        double x     = i + 0.5 * h, in = N[ax] - 1 - L;
+        double rho   = x < L ? (L - x) / L : x > in ? (x - in) / L : 0.0;
+        double sigma = smax * pow(fmin(rho, 1.0), 3);
+        double alpha = PML_ALPHA * (1.0 - fmin(rho, 1.0));
+        double b     = exp(-(sigma + alpha));
+
+        param->pb[h][ax][i] = (Real)b;
+        param->pa[h][ax][i] =
+            sigma > 0 ? (Real)(sigma / (sigma + alpha) * (b - 1.0)) : 0;
+      }
+    }
+  return true;
+}
+
+static bool periodic_init(Grid *grid, BoundaryParam3d *param) {
+  int  N[3] = {grid->param.sizeX, grid->param.sizeY, grid->param.sizeZ};
+  bool any  = false;
+
+  for (int ax = 0; ax < 3; ++ax)
+    any |= param->periodic[ax];
+  if (param->type == Periodic && !any)
+    for (int ax = 0; ax < 3; ++ax)
+      any |= param->periodic[ax] = param->symmetry[ax] == NoSymmetry;
+  if (!any)
+    return true;
+
+  for (int ax = 0; ax < 3; ++ax) {
+    if (!param->periodic[ax])
+      continue;
+    if (param->symmetry[ax] != NoSymmetry) {
+      fprintf(stderr, "[boundary_init_3d] axis %d cannot wrap and mirror\n",
+              ax);
+      return false;
+    }
+    if (N[ax] < 3) {
+      fprintf(stderr, "[boundary_init_3d] periodic axis %d needs 3 cells\n",
+              ax);
+      return false;
+    }
+    if (!param->pair && fabs(sin(param->phase[ax])) > 1e-12) {
+      fprintf(stderr, "[boundary_init_3d] Bloch phase needs a pair grid\n");
+      return false;
+    }
+  }
+
+  Grid *q = param->pair;
+  if (q && (q->param.sizeX != N[0] || q->param.sizeY != N[1] ||
+            q->param.sizeZ != N[2] || q->sx != grid->sx || q->sy != grid->sy)) {
+    fprintf(stderr, "[boundary_init_3d] pair grid has a different layout\n");
+    return false;
+  }
+  // A Bloch pair rotates into the other grid's fields, see periodic_fill.
+  param->zfold = param->periodic[2] && !q;
+  param->zcos  = cos(param->phase[2]);
+  return true;
+}
+
+/*
+ * Attaches param to grid as its boundary (grid->abc), freeing the arrays of
+ * a boundary the grid already has. Everything is checked before either is
+ * touched: on failure false is returned and grid and param stay as they
+ * were.
+ */
+bool boundary_init_3d(Grid *grid, BoundaryType type, BoundaryParam3d *param) {
+  if (!grid || !param || grid->type != ThreeDimension) {
+    fprintf(stderr, "[boundary_init_3d] needs a 3D grid and a param\n");
+    return false;
+  }
+
+  size_t          X  = (size_t)grid->param.sizeX, Y = (size_t)grid->param.sizeY;
+  BoundaryParam3d in = {
+      .type      = type,
+      .pair      = param->pair,
+      .imaginary = param->imaginary,
+  };
+
+  memcpy(in.periodic, param->periodic, sizeof(in.periodic));
+  memcpy(in.phase, param->phase, sizeof(in.phase));
+  memcpy(in.symmetry, param->symmetry, sizeof(in.symmetry));
+  if (!periodic_init(grid, &in))
+    return false;
+  if (type == PML || type == cPML) {
+    in.layers = param->layers;
+    if (!pml_init(grid, &in))
+      return false;
+  } else if (type != Periodic) {
+    in.coef = (grid->param.cdtds - 1.0) / (grid->param.cdtds + 1.0);
+    // A symmetry plane replaces the absorber on its face.
+    for (int f = 0; f < 2; ++f) {
+      bool lo = f == 0;
+      if (!in.periodic[0] && !(lo && in.symmetry[0])) {
+        CALLOC(in.ey[0 + f], Real, Y * grid->row);
+        CALLOC(in.ez[0 + f], Real, Y * grid->row);
+      }
+      if (!in.periodic[1] && !(lo && in.symmetry[1])) {
+        CALLOC(in.ex[2 + f], Real, X * grid->row);
+        CALLOC(in.ez[2 + f], Real, X * grid->row);
+      }
+      if (!in.periodic[2] && !(lo && in.symmetry[2])) {
+        CALLOC(in.ex[4 + f], Real, X * Y);
+        CALLOC(in.ey[4 + f], Real, X * Y);
+      }
+    }
+  }
+
+  if (grid->abc)
+    boundary_free_3d(grid->abc);
+  // The halos feed the far side of the grid, so nothing stays inactive.
+  if (grid->param.activeRegion &&
+      (in.periodic[0] || in.periodic[1] || in.periodic[2]))
+    grid->active = _grid_box(grid);
+  *param    = in;
+  grid->abc = param;
+  return true;
+}
+
+static void boundary_free_3d(BoundaryParam3d *param) {
+  for (int f = 0; f < 6; ++f) {
+    FREE(param->ex[f]);
+    FREE(param->ey[f]);
+    FREE(param->ez[f]);
+    for (int ax = 0; ax < 3; ++ax)
+      FREE(param->psi[f][ax]);
+  }
+  for (int h = 0; h < 2; ++h)
+    for (int ax = 0; ax < 3; ++ax) {
+      FREE(param->pb[h][ax]);
+      FREE(param->pa[h][ax]);
+    }
+}
+
+// Faces fed by the just updated row (mm, nn, [z0, z1)) of component f. The
+// two z-face cells are inlined, every row of a full-z sweep has them.
+static inline void mur_faces(Grid *grid, Real *f, Real *const *hist, int mm,
+                             int nn, int z0, int z1) {
+  int    X = grid->param.sizeX, Y = grid->param.sizeY, Z = grid->param.sizeZ;
+  int    n = z1 - z0;
+  Real   c = (Real)grid->abc->coef;
+  size_t r = grid->row, sx = grid->sx, sy = grid->sy;
+  size_t i = IDX3(mm, nn, z0, sx, sy);
+
+  if (n <= 0)
+    return;
+  if (hist[4] && z0 == 1) {
+    Real *old = &hist[4][IDX2(mm, nn, Y)], e = f[i];
+    f[i - 1]  = MUR_EXPR(*old, c, e, f[i - 1]);
+    *old      = e;
+  }
+  if (hist[5] && z1 == Z - 1) {
+    Real *old = &hist[5][IDX2(mm, nn, Y)], e = f[i + n - 1];
+    f[i + n]  = MUR_EXPR(*old, c, e, f[i + n]);
+    *old      = e;
+  }
+  if (mm != 1 && mm != X - 2 && nn != 1 && nn != Y - 2)
+    return;
+  if (hist[0] && mm == 1)
+    grid->mur_row(f + i - sx, f + i, hist[0] + IDX2(nn, z0, r), c, n);
+  if (hist[1] && mm == X - 2)
+    grid->mur_row(f + i + sx, f + i, hist[1] + IDX2(nn, z0, r), c, n);
+  if (hist[2] && nn == 1)
+    grid->mur_row(f + i - sy, f + i, hist[2] + IDX2(mm, z0, r), c, n);
+  if (hist[3] && nn == Y - 2)
+    grid->mur_row(f + i + sy, f + i, hist[3] + IDX2(mm, z0, r), c, n);
+}
+
+#define PML_CHUNK 64
+
+// CPML correction (grid->pml_row) of the n cells of c from flat index i,
+// each with the curl coefficient of its own update times sign. The profile
+// is per cell (step 1) along z and one value per row (step 0) along x and y.
+static void pml_cells(Grid *grid, int c, size_t i, Real *f, const Real *f1,
+                      const Real *f0, Real *psi, const Real *pb,
+                      const Real *pa, int step, Real sign, int n) {
+  if (grid->param.uniform) {
+    grid->pml_row(f, f1, f0, psi, pb, pa, step, NULL,
+                  sign * (c < 3 ? grid->ce : grid->ch), n);
+    return;
+  }
+  if (grid->param.materials == 0) {
+    const Real *cg[6] = {grid->cexh, grid->ceyh, grid->cezh,
+                         grid->chxe, grid->chye, grid->chze};
+    grid->pml_row(f, f1, f0, psi, pb, pa, step, cg[c] + i, sign, n);
+    return;
+  }
+
+  const uint8_t *id[6] = {grid->mex, grid->mey, grid->mez,
+                          grid->mhx, grid->mhy, grid->mhz};
+  const Real    *mat   = c < 3 ? grid->mat_ceh : grid->mat_che;
+  Real           cg[PML_CHUNK];
+
+  for (int lo = 0, n1; lo < n; lo += n1) {
+    n1 = _min_int(PML_CHUNK, n - lo);
+    for (int k = 0; k < n1; k++) {
+      size_t j = i + lo + k;
+      cg[k]    = mat[grid->mat_width == 2 ? ((const uint16_t *)id[c])[j]
+                                          : id[c][j]];
+    }
+    grid->pml_row(f + lo, f1 + lo, f0 + lo, psi + lo, pb + lo * step,
+                  pa + lo * step, step, cg, sign, n1);
+  }
+}
+
+/*
+ * The two curl differences of component c (ex, ey, ez, hx, hy, hz) as in
+ * update_*_3d: axis, field, offsets of the two cells and sign.
+ */
+typedef struct {
+  int         axis;
+  const Real *g;
+  ptrdiff_t   d1, d0;
+  int         sign;
+} PmlTerm;
+
+static void pml_terms(const Grid *grid, int c, PmlTerm t[2]) {
+  ptrdiff_t sx = (ptrdiff_t)grid->sx, sy = (ptrdiff_t)grid->sy;
+
+  switch (c) {
+  case 0:
+    t[0] = (PmlTerm){1, grid->hz, 0, -sy, 1};
+    t[1] = (PmlTerm){2, grid->hy, 0, -1, -1};
+    break;
+  case 1:
+    t[0] = (PmlTerm){2, grid->hx, 0, -1, 1};
+    t[1] = (PmlTerm){0, grid->hz, 0, -sx, -1};
+    break;
+  case 2:
+    t[0] = (PmlTerm){0, grid->hy, 0, -sx, 1};
+    t[1] = (PmlTerm){1, grid->hx, 0, -sy, -1};
+    break;
+  case 3:
+    t[0] = (PmlTerm){2, grid->ey, 1, 0, 1};
+    t[1] = (PmlTerm){1, grid->ez, sy, 0, -1};
+    break;
+  case 4:
+    t[0] = (PmlTerm){0, grid->ez, sx, 0, 1};
+    t[1] = (PmlTerm){2, grid->ex, 1, 0, -1};
+    break;
+  default:
+    t[0] = (PmlTerm){1, grid->ex, sy, 0, 1};
+    t[1] = (PmlTerm){0, grid->ey, sx, 0, -1};
+    break;
+  }
+}
+
+// CPML corrections for the just updated row (mm, nn, [z0, z1)) of c.
+static void pml_rows(Grid *grid, int c, Real *f, int mm, int nn, int z0,
+                     int z1) {
+  BoundaryParam3d *b = grid->abc;
+  int              X = grid->param.sizeX, Y = grid->param.sizeY;
+  int              Z = grid->param.sizeZ, s = b->layers + 1;
+  int              h = c >= 3;
+  size_t           r = grid->row, i = IDX3(mm, nn, z0, grid->sx, grid->sy);
+  PmlTerm          t[2];
+
+  pml_terms(grid, c, t);
+  for (int k = 0; k < 2; ++k) {
+    const Real *f1 = t[k].g + i + t[k].d1, *f0 = t[k].g + i + t[k].d0;
+    const Real *pb = b->pb[h][t[k].axis], *pa = b->pa[h][t[k].axis];
+    Real       *psi = b->psi[c][t[k].axis];
+    Real        sg  = (Real)t[k].sign;
+    int         j;
+
+    if (!psi)
+      continue;
+
+    switch (t[k].axis) {
+    case 0:
+      if ((j = _pml_slot(mm, X, s)) >= 0 && (j >= s || !b->symmetry[0]))
+        pml_cells(grid, c, i, f + i, f1, f0,
+                  psi + IDX3(j, nn, z0, (size_t)Y * r, r), pb + mm, pa + mm,
+                  0, sg, z1 - z0);
+      break;
+    case 1:
+      if ((j = _pml_slot(nn, Y, s)) >= 0 && (j >= s || !b->symmetry[1]))
+        pml_cells(grid, c, i, f + i, f1, f0,
+                  psi + IDX3(mm, j, z0, 2 * (size_t)s * r, r), pb + nn,
+                  pa + nn, 0, sg, z1 - z0);
+      break;
+    default:
+      psi += IDX3(mm, nn, 0, (size_t)Y * 2 * s, 2 * s);
+      for (int lo = z0, hi; lo < z1; lo = hi) {
+        // Low slab [0, s), interior, high slab [Z - s, Z).
+        hi = lo < s ? _min_int(z1, s) : lo < Z - s ? Z - s : z1;
+        if ((j = _pml_slot(lo, Z, s)) >= 0 && (j >= s || !b->symmetry[2]))
+          pml_cells(grid, c, i + (lo - z0), f + i + (lo - z0),
+                    f1 + (lo - z0), f0 + (lo - z0), psi + j, pb + lo,
+                    pa + lo, 1, sg, hi - lo);
+      }
+      break;
+    }
+  }
+}
+
+// Periodic z halos of the row (mm, nn) of c from their images in the same
+// row: cell 0 from Z - 2, and Z - 1 from 1 where the component has it.
+static inline void periodic_row(Grid *grid, int c, Real *f, int mm, int nn) {
+  int   Z = grid->param.sizeZ;
+  Accum k = (Accum)grid->abc->zcos;
+  Real *r = f + IDX3(mm, nn, 0, grid->sx, grid->sy);
+
+  r[0] = (Real)(k * r[Z - 2]);
+  if (c < 2 || c == 5)
+    r[Z - 1] = (Real)(k * r[1]);
+}
+
+// Refolds the row after a write to its cells [z0, z1) outside the sweep.
+static inline void _periodic_touch(Grid *grid, int c, Real *f, int mm, int nn,
+                                   int z0, int z1) {
+  int Z = grid->param.sizeZ;
+
+  if (grid->abc && grid->abc->zfold &&
+      ((z0 <= 1 && z1 > 1) || (z0 <= Z - 2 && z1 > Z - 2)))
+    periodic_row(grid, c, f, mm, nn);
+}
+
+// Boundary work for the just updated row (mm, nn, [z0, z1)) of component c.
+// Periodic z halos are refolded once the last segment of the row is done.
+static inline void boundary_row(Grid *grid, int c, Real *f, int mm, int nn,
+                                int z0, int z1) {
+  BoundaryParam3d *b = grid->abc;
+
+  if (b->type == PML || b->type == cPML)
+    pml_rows(grid, c, f, mm, nn, z0, z1);
+  else if (b->type == ABC && c < 3)
+    mur_faces(grid, f, c == 0 ? b->ex : c == 1 ? b->ey : b->ez, mm, nn, z0,
+              z1);
+  if (b->zfold && z1 == grid->param.sizeZ - (c != 5))
+    periodic_row(grid, c, f, mm, nn);
+}
+
+/*
+ * Symmetry planes through the E nodes at index 0 of an axis, so that a
+ * problem symmetric about the plane is simulated on the half at index >= 0
+ * only (a quarter with two axes, an eighth with three).
+ *
+ * ElectricWall (PEC) is the wall every face already has: tangential E on
+ * the plane is odd and stays zero. MagneticWall (PMC) makes tangential E
+ * even and tangential H odd, so the missing H half a cell outside is
+ * -H(1/2) and the curl difference across the plane becomes 2 H(1/2). The
+ * tangential E cells on the plane, which the sweeps skip, are advanced by
+ * mirror_box as part of the E phase of every box that contains them, and
+ * then get the absorber work of the other axes. symmetry_field unfolds the
+ * reduced grid into the full domain for output.
+ */
+#define MIRROR_CHUNK 64
+
+static inline bool _mirrored(const BoundaryParam3d *b) {
+  return b->symmetry[0] == MagneticWall || b->symmetry[1] == MagneticWall ||
+         b->symmetry[2] == MagneticWall;
+}
+
+// Advances cells [z0, z1) of the E row (mm, nn) of c, with every curl
+// difference taken across a magnetic wall (index 0) doubled. z0 = 0 on a z
+// wall only comes as a single cell.
+static void mirror_cells(Grid *grid, int c, Real *f, int mm, int nn, int z0,
+                         int z1) {
+  const Real    *cf[3] = {grid->cexe, grid->ceye, grid->ceze};
+  const Real    *cg[3] = {grid->cexh, grid->ceyh, grid->cezh};
+  const uint8_t *id[3] = {grid->mex, grid->mey, grid->mez};
+  const int      at[3] = {mm, nn, z0};
+  size_t         i     = IDX3(mm, nn, z0, grid->sx, grid->sy);
+  Real           image[2][MIRROR_CHUNK];
+  PmlTerm        t[2];
+
+  pml_terms(grid, c, t);
+  for (int lo = 0, n; lo < z1 - z0; lo += n) {
+    const Real *g1[2], *g0[2];
+
+    n = _min_int(MIRROR_CHUNK, z1 - z0 - lo);
+    for (int k = 0; k < 2; k++) {
+      g1[k] = t[k].g + i + lo + t[k].d1;
+      g0[k] = t[k].g + i + lo + t[k].d0;
+      if (at[t[k].axis] != 0 || grid->abc->symmetry[t[k].axis] != MagneticWall)
+        continue;
+      for (int j = 0; j < n; j++)
+        image[k][j] = -g1[k][j];
+      g0[k] = image[k];
+    }
+    curl_row_at(grid, false, f, cf[c], cg[c], id[c], i + lo, g1[0], g0[0],
+                g1[1], g0[1], n);
+  }
+}
+
+// Magnetic wall cells of the E components inside `box`: whole rows on an x
+// or y wall, the first cell of every row on a z wall.
+static void mirror_box(Grid *grid, Box3d box) {
+  const Symmetry *w    = grid->abc->symmetry;
+  int             N[3] = {grid->param.sizeX, grid->param.sizeY,
+                          grid->param.sizeZ};
+  Real           *f[3] = {grid->ex, grid->ey, grid->ez};
+
+  for (int c = 0; c < 3; c++) {
+    bool wx = c != 0 && w[0] == MagneticWall && box.x0 <= 0;
+    bool wy = c != 1 && w[1] == MagneticWall && box.y0 <= 0;
+    bool wz = c != 2 && w[2] == MagneticWall && box.z0 <= 0;
+
+    if (!wx && !wy && !wz)
+      continue;
+
+    int x0 = _max_int(box.x0, wx || c == 0 ? 0 : 1);
+    int y0 = _max_int(box.y0, wy || c == 1 ? 0 : 1);
+    int z0 = _max_int(box.z0, wz || c == 2 ? 0 : 1);
+    int x1 = _min_int(box.x1, N[0] - 1), y1 = _min_int(box.y1, N[1] - 1);
+    int z1 = _min_int(box.z1, N[2] - 1);
+
+    for (int mm = x0; mm < x1; mm++)
+      for (int nn = y0; nn < y1; nn++) {
+        bool row = (wx && mm == 0) || (wy && nn == 0);
+        int  p0  = z0, p1 = row ? z1 : _min_int(z1, 1);
+
+        if (wz && p0 == 0 && p0 < p1) {
+          mirror_cells(grid, c, f[c], mm, nn, 0, 1);
+          boundary_row(grid, c, f[c], mm, nn, 0, 1);
+          p0 = 1;
+        }
+        if (row && p0 < p1) {
+          mirror_cells(grid, c, f[c], mm, nn, p0, p1);
+          boundary_row(grid, c, f[c], mm, nn, p0, p1);
+        }
+      }
+  }
+}
+
+// Index range of the full domain the grid is the mirrored part of.
+Box3d symmetry_box(const Grid *grid) {
+  const BoundaryParam3d *b   = grid->abc;
+  Box3d                  box = _grid_box(grid);
+
+  if (b && b->symmetry[0])
+    box.x0 = 1 - box.x1;
+  if (b && b->symmetry[1])
+    box.y0 = 1 - box.y1;
+  if (b && b->symmetry[2])
+    box.z0 = 1 - box.z1;
+  return box;
+}
+
+/*
+ * Component c (ex, ey, ez, hx, hy, hz) at index (m, n, p) of the full
+ * domain, negative indices being images across the symmetry planes. The
+ * image of index i is -i, or -i - 1 for a component at half cells along the
+ * axis, and is odd for tangential E and normal H on an ElectricWall and the
+ * other way round on a MagneticWall. Indices outside the component read as
+ * zero.
+ */
+Real symmetry_field(const Grid *grid, int c, int m, int n, int p) {
+  const BoundaryParam3d *b    = grid->abc;
+  const Real            *f[6] = {grid->ex, grid->ey, grid->ez,
+                                 grid->hx, grid->hy, grid->hz};
+  int  N[3]  = {grid->param.sizeX, grid->param.sizeY, grid->param.sizeZ};
+  int  at[3] = {m, n, p};
+  bool odd   = false;
+
+  for (int ax = 0; ax < 3; ax++) {
+    bool half = (c < 3) == (ax == c % 3);
+
+    if (at[ax] < 0) {
+      if (!b || b->symmetry[ax] == NoSymmetry)
+        return 0;
+      at[ax] = half ? -at[ax] - 1 : -at[ax];
+      odd ^= ((c < 3) == (ax != c % 3)) != (b->symmetry[ax] == MagneticWall);
+    }
+    if (at[ax] >= N[ax] - half)
+      return 0;
+  }
+
+  Real v = f[c][IDX3(at[0], at[1], at[2], grid->sx, grid->sy)];
+  return odd ? -v : v;
+}
+
+/*
+ * Periodic and Bloch-periodic axes, wrapped through one halo plane per
+ * side: on an axis of n cells index 0 is the image of n - 2 and index n - 1
+ * that of 1, so the period is n - 2 cells and the unit cell [1, n - 2].
+ * Components at half-cell positions along the axis only have the low halo.
+ * The sweeps run over the whole grid as usual, and before each phase the
+ * halos of the fields it reads are overwritten from their images: E at the
+ * start of updateH, H at the start of updateE. This also replaces whatever
+ * the sweeps, or an absorbing boundary on another axis, left in a halo.
+ *
+ * The z halos of a row sit next to their images, so they are refolded by
+ * boundary_row as soon as the row is swept (zfold), and by TFSF and wire
+ * work that lands on an image afterwards; periodic_fill then visits only
+ * the x and y frame rows. A sample at z = 1 or Z - 2 written between phases,
+ * by source_inject or a StepHook, is therefore not seen through its halo
+ * until its row is swept again: keep sources off those two planes.
+ *
+ * A Bloch phase makes the field complex. Its real and imaginary parts are
+ * two grids of the same shape, each with a BoundaryParam3d naming the other
+ * as `pair`, and an image k periods away is rotated by k * phase. The two
+ * have to advance in lockstep, updateH on both before updateE on either,
+ * so that every image read is at the right time level; grid_step_blocked
+ * and grid_step_fused step one grid and so refuse either of them.
+ */
+static inline bool _periodic(const Grid *grid) {
+  const BoundaryParam3d *b = grid->abc;
+  return b && (b->periodic[0] || b->periodic[1] || b->periodic[2]);
+}
+
+// Image of index i on a periodic axis of n cells; *k counts periods crossed.
+static inline int _halo_image(int i, int n, int *k) {
+  if (i == 0) {
+    *k -= 1;
+    return n - 2;
+  }
+  if (i == n - 1) {
+    *k += 1;
+    return 1;
+  }
+  return i;
+}
+
+// d[i] = c * f[i] + s * g[i], g being the pair's part (NULL without one).
+static void _halo_cells(Real *d, const Real *f, const Real *g, double c,
+                        double s, int n) {
+  if (!g) {
+    for (int i = 0; i < n; i++)
+      d[i] = (Real)((Accum)c * f[i]);
+    return;
+  }
+  for (int i = 0; i < n; i++)
+    d[i] = (Real)((Accum)c * f[i] + (Accum)s * g[i]);
+}
+
+static void periodic_fill(Grid *grid, bool magnetic) {
+  BoundaryParam3d *b    = grid->abc;
+  Grid            *q    = b->pair;
+  const bool      *wrap = b->periodic;
+  int    N[3] = {grid->param.sizeX, grid->param.sizeY, grid->param.sizeZ};
+  Real  *f[6] = {grid->ex, grid->ey, grid->ez, grid->hx, grid->hy, grid->hz};
+  Real  *g[6] = {0};
+  double rc[27], rs[27];
+
+  if (q) {
+    Real *pf[6] = {q->ex, q->ey, q->ez, q->hx, q->hy, q->hz};
+    memcpy(g, pf, sizeof(g));
+  }
+  // Rotation for (kx, ky, kz) periods at (kx + 1) * 9 + (ky + 1) * 3 + kz + 1.
+  for (int r = 0; r < 27; r++) {
+    double t = (r / 9 - 1) * b->phase[0] + (r / 3 % 3 - 1) * b->phase[1] +
+               (r % 3 - 1) * b->phase[2];
+    rc[r] = cos(t);
+    rs[r] = b->imaginary ? sin(t) : -sin(t);
+  }
+
+  for (int c = magnetic ? 3 : 0; c < (magnetic ? 6 : 3); c++) {
+    int n[3];
+    for (int ax = 0; ax < 3; ax++)
+      n[ax] = N[ax] - ((c < 3) == (ax == c % 3));
+
+    for (int mm = 0; mm < n[0]; mm++) {
+      // The sweeps refold the z halos of every row but the frame ones.
+      bool em   = mm == 0 || mm == N[0] - 1;
+      int  step = em || !b->zfold ? 1 : _max_int(N[1] - 1, 1);
+
+      for (int nn = 0; nn < n[1]; nn += step) {
+        bool en = nn == 0 || nn == N[1] - 1;
+        bool hm = wrap[0] && em;
+        bool hn = wrap[1] && en;
+        bool hz = wrap[2] && (!b->zfold || em || en);
+        int  k[3] = {0, 0, 0};
+
+        if (!hm && !hn && !hz)
+          continue;
+
+        int    m1  = hm ? _halo_image(mm, N[0], &k[0]) : mm;
+        int    n1  = hn ? _halo_image(nn, N[1], &k[1]) : nn;
+        size_t d   = IDX3(mm, nn, 0, grid->sx, grid->sy);
+        size_t src = IDX3(m1, n1, 0, grid->sx, grid->sy);
+        int    r   = (k[0] + 1) * 9 + (k[1] + 1) * 3;
+        Real  *gs  = g[c] ? g[c] + src : NULL;
+
+        if (hm || hn)
+          _halo_cells(f[c] + d, f[c] + src, gs, rc[r + 1], rs[r + 1], n[2]);
+        if (!hz)
+          continue;
+        // z halos: cell 0, and cell N - 1 where the component has one.
+        for (int e = 0; e < (n[2] == N[2] ? 2 : 1); e++) {
+          int pp = e ? N[2] - 1 : 0, kz = 0;
+          int p1 = _halo_image(pp, N[2], &kz);
+          _halo_cells(f[c] + d + pp, f[c] + src + p1, gs ? gs + p1 : NULL,
+                      rc[r + kz + 1], rs[r + kz + 1], 1);
+        }
+      }
+    }
+  }
+}
+
+static void update_hx_3d(Grid *grid, Box3d slab) {
+  int X = grid->param.sizeX, Y = grid->param.sizeY, Z = grid->param.sizeZ;
+  int x0 = _max_int(slab.x0, 0), x1 = _min_int(slab.x1, X);
+  int y0 = _max_int(slab.y0, 0), y1 = _min_int(slab.y1, Y - 1);
+  int z0 = _max_int(slab.z0, 0), z1 = _min_int(slab.z1, Z - 1);
+
+  size_t sx = grid->sx, sy = grid->sy;
+
+  uint64_t t0 = PROF_BEGIN();
+
+  for (int mm = x0; mm < x1; mm++) {
+    for (int nn = y0; nn < y1; nn++) {
+      size_t i = IDX3(mm, nn, z0, sx, sy);
+      curl_row_at(grid, true, grid->hx, grid->chxh, grid->chxe, grid->mhx, i,
+                  grid->ey + i + 1, grid->ey + i, grid->ez + i + sy,
+                  grid->ez + i, z1 - z0);
+      if (grid->abc)
+        boundary_row(grid, 3, grid->hx, mm, nn, z0, z1);
+    }
+  }
+
+  PROF_END(grid, ProfUpdateHx, t0, _box_cells(x0, x1, y0, y1, z0, z1));
+}
+
+static void update_hy_3d(Grid *grid, Box3d slab) {
+  int X = grid->param.sizeX, Y = grid->param.sizeY, Z = grid->param.sizeZ;
+  int x0 = _max_int(slab.x0, 0), x1 = _min_int(slab.x1, X - 1);
+  int y0 = _max_int(slab.y0, 0), y1 = _min_int(slab.y1, Y);
+  int z0 = _max_int(slab.z0, 0), z1 = _min_int(slab.z1, Z - 1);
+
+  size_t sx = grid->sx, sy = grid->sy;
+
+  uint64_t t0 = PROF_BEGIN();
+
+  for (int mm = x0; mm < x1; mm++) {
+    for (int nn = y0; nn < y1; nn++) {
+      size_t i = IDX3(mm, nn, z0, sx, sy);
+      curl_row_at(grid, true, grid->hy, grid->chyh, grid->chye, grid->mhy, i,
+                  grid->ez + i + sx, grid->ez + i, grid->ex + i + 1,
+                  grid->ex + i, z1 - z0);
+      if (grid->abc)
+        boundary_row(grid, 4, grid->hy, mm, nn, z0, z1);
+    }
+  }
+
+  PROF_END(grid, ProfUpdateHy, t0, _box_cells(x0, x1, y0, y1, z0, z1));
+}
+
+static void update_hz_3d(Grid *grid, Box3d slab) {
+  int X = grid->param.sizeX, Y = grid->param.sizeY, Z = grid->param.sizeZ;
+  int x0 = _max_int(slab.x0, 0), x1 = _min_int(slab.x1, X - 1);
+  int y0 = _max_int(slab.y0, 0), y1 = _min_int(slab.y1, Y - 1);
+  int z0 = _max_int(slab.z0, 0), z1 = _min_int(slab.z1, Z);
+
+  size_t sx = grid->sx, sy = grid->sy;
+
+  uint64_t t0 = PROF_BEGIN();
+
+  for (int mm = x0; mm < x1; mm++) {
+    for (int nn = y0; nn < y1; nn++) {
+      size_t i = IDX3(mm, nn, z0, sx, sy);
+      curl_row_at(grid, true, grid->hz, grid->chzh, grid->chze, grid->mhz, i,
+                  grid->ex + i + sy, grid->ex + i, grid->ey + i + sx,
+                  grid->ey + i, z1 - z0);
+      if (grid->abc)
+        boundary_row(grid, 5, grid->hz, mm, nn, z0, z1);
+    }
+  }
+
+  PROF_END(grid, ProfUpdateHz, t0, _box_cells(x0, x1, y0, y1, z0, z1));
+}
+
+static void update_ex_3d(Grid *grid, Box3d slab) {
+  int X = grid->param.sizeX, Y = grid->param.sizeY, Z = grid->param.sizeZ;
+  int x0 = _max_int(slab.x0, 0), x1 = _min_int(slab.x1, X - 1);
+  int y0 = _max_int(slab.y0, 1), y1 = _min_int(slab.y1, Y - 1);
+  int z0 = _max_int(slab.z0, 1), z1 = _min_int(slab.z1, Z - 1);
+
+  size_t sx = grid->sx, sy = grid->sy;
+
+  uint64_t t0 = PROF_BEGIN();
+
+  for (int mm = x0; mm < x1; mm++) {
+    for (int nn = y0; nn < y1; nn++) {
+      size_t i = IDX3(mm, nn, z0, sx, sy);
+      curl_row_at(grid, false, grid->ex, grid->cexe, grid->cexh, grid->mex, i,
+                  grid->hz + i, grid->hz + i - sy, grid->hy + i,
+                  grid->hy + i - 1, z1 - z0);
+      if (grid->abc)
+        boundary_row(grid, 0, grid->ex, mm, nn, z0, z1);
+    }
+  }
+
+  PROF_END(grid, ProfUpdateEx, t0, _box_cells(x0, x1, y0, y1, z0, z1));
+}
+
+static void update_ey_3d(Grid *grid, Box3d slab) {
+  int X = grid->param.sizeX, Y = grid->param.sizeY, Z = grid->param.sizeZ;
+  int x0 = _max_int(slab.x0, 1), x1 = _min_int(slab.x1, X - 1);
+  int y0 = _max_int(slab.y0, 0), y1 = _min_int(slab.y1, Y - 1);
+  int z0 = _max_int(slab.z0, 1), z1 = _min_int(slab.z1, Z - 1);
+
+  size_t sx = grid->sx, sy = grid->sy;
+
+  uint64_t t0 = PROF_BEGIN();
+
+  for (int mm = x0; mm < x1; mm++) {
+    for (int nn = y0; nn < y1; nn++) {
+      size_t i = IDX3(mm, nn, z0, sx, sy);
+      curl_row_at(grid, false, grid->ey, grid->ceye, grid->ceyh, grid->mey, i,
+                  grid->hx + i, grid->hx + i - 1, grid->hz + i,
+                  grid->hz + i - sx, z1 - z0);
+      if (grid->abc)
+        boundary_row(grid, 1, grid->ey, mm, nn, z0, z1);
+    }
+  }
+
+  PROF_END(grid, ProfUpdateEy, t0, _box_cells(x0, x1, y0, y1, z0, z1));
+}
+
+static void update_ez_3d(Grid *grid, Box3d slab) {
+  int X = grid->param.sizeX, Y = grid->param.sizeY, Z = grid->param.sizeZ;
+  int x0 = _max_int(slab.x0, 1), x1 = _min_int(slab.x1, X - 1);
+  int y0 = _max_int(slab.y0, 1), y1 = _min_int(slab.y1, Y - 1);
+  int z0 = _max_int(slab.z0, 0), z1 = _min_int(slab.z1, Z - 1);
+
+  size_t sx = grid->sx, sy = grid->sy;
+
+  uint64_t t0 = PROF_BEGIN();
+
+  for (int mm = x0; mm < x1; mm++) {
+    for (int nn = y0; nn < y1; nn++) {
+      size_t i = IDX3(mm, nn, z0, sx, sy);
+      curl_row_at(grid, false, grid->ez, grid->ceze, grid->cezh, grid->mez, i,
+                  grid->hy + i, grid->hy + i - sx, grid->hx + i,
+                  grid->hx + i - sy, z1 - z0);
+      if (grid->abc)
+        boundary_row(grid, 2, grid->ez, mm, nn, z0, z1);
+    }
+  }
+
+  PROF_END(grid, ProfUpdateEz, t0, _box_cells(x0, x1, y0, y1, z0, z1));
+}
+
+/*
+ * Fixed-extent kernels. The generic sweeps above read the extents and strides
+ * from the grid and reach every row through a kernel pointer, so the
+ * compiler sees neither the row length nor the strides. For the (sizeY,
+ * sizeZ) pairs in FDTD_FIXED_EXTENTS the same six updates are instantiated
+ * with both as constants, the C counterpart of NX_0/NY_0/NZ_0 in
+ * hardware/def.h: fixed_update_h/e are always inlined with literal extents,
+ * so every row loop has a constant trip count and constant neighbour
+ * offsets and is fully vectorized and unrolled for the instantiating ISA.
+ * Each cell is still evaluated by CURL_EXPR without contraction, so results
+ * are bit-identical to the generic path.
+ *
+ * grid_init picks an entry (grid->fixed) when sizeY, sizeZ and the selected
+ * SIMD level match and the grid uses the default padding and no material
+ * IDs; everything else, and any box that does not span the whole z axis,
+ * runs the generic sweeps. Boundary rows (Mur faces, CPML corrections) are
+ * finished right after each row, as there. Define FDTD_FIXED_EXTENTS
+ * before including the header to build a different list, or as nothing to
+ * build none.
+ */
+#ifndef FDTD_FIXED_EXTENTS
+  #define FDTD_FIXED_EXTENTS(X) X(32, 70) X(64, 64) X(128, 128) X(256, 256)
+#endif
+
+#define FIXED_INLINE static inline __attribute__((always_inline))
+
+FIXED_INLINE size_t _fixed_sy(int nz) {
+  size_t line = GRID_ALIGN / sizeof(Real);
+  return ((size_t)nz + line - 1) / line * line;
+}
+
+// One row of n cells at offset i; cf == NULL means uniform medium, cg = c.
+FIXED_INLINE void fixed_row(Real *restrict f, const Real *restrict cf,
+                            const Real *restrict cg, Real c, size_t i,
+                            const Real *restrict a1, const Real *restrict a0,
+                            const Real *restrict b1, const Real *restrict b0,
+                            int n) {
+  f += i, a1 += i, a0 += i, b1 += i, b0 += i;
+  if (!cf) {
+    for (int k = 0; k < n; k++)
+      f[k] = CURL_EXPR(1, f[k], c, a1[k], a0[k], b1[k], b0[k]);
+    return;
+  }
+
+  cf += i, cg += i;
+  for (int k = 0; k < n; k++)
+    f[k] = CURL_EXPR(cf[k], f[k], cg[k], a1[k], a0[k], b1[k], b0[k]);
+}
+
+FIXED_INLINE void fixed_update_h(Grid *grid, Box3d box, int ny, int nz) {
+  size_t sy = _fixed_sy(nz), sx = (size_t)ny * sy;
+  int    X  = grid->param.sizeX;
+  int    x0 = _max_int(box.x0, 0), x1 = _min_int(box.x1, X);
+  int    y0 = _max_int(box.y0, 0), y1 = _min_int(box.y1, ny);
+  Real   c  = grid->ch;
+
+  uint64_t t0 = PROF_BEGIN();
+  for (int mm = x0; mm < x1; mm++)
+    for (int nn = y0; nn < _min_int(y1, ny - 1); nn++) {
+      fixed_row(grid->hx, grid->chxh, grid->chxe, c, IDX3(mm, nn, 0, sx, sy),
+                grid->ey + 1, grid->ey, grid->ez + sy, grid->ez, nz - 1);
+      if (grid->abc)
+        boundary_row(grid, 3, grid->hx, mm, nn, 0, nz - 1);
+    }
+  PROF_END(grid, ProfUpdateHx, t0,
+           _box_cells(x0, x1, y0, _min_int(y1, ny - 1), 0, nz - 1));
+
+  t0 = PROF_BEGIN();
+  for (int mm = x0; mm < _min_int(x1, X - 1); mm++)
+    for (int nn = y0; nn < y1; nn++) {
+      fixed_row(grid->hy, grid->chyh, grid->chye, c, IDX3(mm, nn, 0, sx, sy),
+                grid->ez + sx, grid->ez, grid->ex + 1, grid->ex, nz - 1);
+      if (grid->abc)
+        boundary_row(grid, 4, grid->hy, mm, nn, 0, nz - 1);
+    }
+  PROF_END(grid, ProfUpdateHy, t0,
+           _box_cells(x0, _min_int(x1, X - 1), y0, y1, 0, nz - 1));
+
+  t0 = PROF_BEGIN();
+  for (int mm = x0; mm < _min_int(x1, X - 1); mm++)
+    for (int nn = y0; nn < _min_int(y1, ny - 1); nn++) {
+      fixed_row(grid->hz, grid->chzh, grid->chze, c, IDX3(mm, nn, 0, sx, sy),
+                grid->ex + sy, grid->ex, grid->ey + sx, grid->ey, nz);
+      if (grid->abc)
+        boundary_row(grid, 5, grid->hz, mm, nn, 0, nz);
+    }
+  PROF_END(grid, ProfUpdateHz, t0,
+           _box_cells(x0, _min_int(x1, X - 1), y0, _min_int(y1, ny - 1), 0,
+                      nz));
+}
+
+FIXED_INLINE void fixed_update_e(Grid *grid, Box3d box, int ny, int nz) {
+  size_t sy = _fixed_sy(nz), sx = (size_t)ny * sy;
+  int    X  = grid->param.sizeX;
+  int    x0 = _max_int(box.x0, 0), x1 = _min_int(box.x1, X - 1);
+  int    y0 = _max_int(box.y0, 0), y1 = _min_int(box.y1, ny - 1);
+  Real   c  = grid->ce;
+
+  uint64_t t0 = PROF_BEGIN();
+  for (int mm = x0; mm < x1; mm++)
+    for (int nn = _max_int(y0, 1); nn < y1; nn++) {
+      fixed_row(grid->ex, grid->cexe, grid->cexh, c, IDX3(mm, nn, 1, sx, sy),
+                grid->hz, grid->hz - sy, grid->hy, grid->hy - 1, nz - 2);
+      if (grid->abc)
+        boundary_row(grid, 0, grid->ex, mm, nn, 1, nz - 1);
+    }
+  PROF_END(grid, ProfUpdateEx, t0,
+           _box_cells(x0, x1, _max_int(y0, 1), y1, 1, nz - 1));
+
+  t0 = PROF_BEGIN();
+  for (int mm = _max_int(x0, 1); mm < x1; mm++)
+    for (int nn = y0; nn < y1; nn++) {
+      fixed_row(grid->ey, grid->ceye, grid->ceyh, c, IDX3(mm, nn, 1, sx, sy),
+                grid->hx, grid->hx - 1, grid->hz, grid->hz - sx, nz - 2);
+      if (grid->abc)
+        boundary_row(grid, 1, grid->ey, mm, nn, 1, nz - 1);
+    }
+  PROF_END(grid, ProfUpdateEy, t0,
+           _box_cells(_max_int(x0, 1), x1, y0, y1, 1, nz - 1));
+
+  t0 = PROF_BEGIN();
+  for (int mm = _max_int(x0, 1); mm < x1; mm++)
+    for (int nn = _max_int(y0, 1); nn < y1; nn++) {
+      fixed_row(grid->ez, grid->ceze, grid->cezh, c, IDX3(mm, nn, 0, sx, sy),
+                grid->hy, grid->hy - sx, grid->hx, grid->hx - sy, nz - 1);
+      if (grid->abc)
+        boundary_row(grid, 2, grid->ez, mm, nn, 0, nz - 1);
+    }
+  PROF_END(grid, ProfUpdateEz, t0,
+           _box_cells(_max_int(x0, 1), x1, _max_int(y0, 1), y1, 0, nz - 1));
+}
+
+typedef struct {
+  int       ny, nz;
+  SimdLevel simd;
+  SlabJob   h, e;
+} FixedExtent;
+
+#if defined(__x86_64__) || defined(__i386__)
+  #if defined(__GNUC__) && !defined(__clang__)
+    #define FIXED_TARGET(ISA)                                                  \
+      target(ISA), optimize("fp-contract=off", "tree-vectorize",               \
+                            "vect-cost-model=dynamic")
+  #else
+    #define FIXED_TARGET(ISA) target(ISA)
+  #endif
+
+  #define FIXED_KERNELS(ISA, TARGET, NY, NZ)                                   \
+    __attribute__((FIXED_TARGET(TARGET))) static void                          \
+        update_h_##ISA##_##NY##x##NZ(Grid *grid, Box3d box) {                  \
+      fixed_update_h(grid, box, NY, NZ);                                       \
+    }                                                                          \
+    __attribute__((FIXED_TARGET(TARGET))) static void                          \
+        update_e_##ISA##_##NY##x##NZ(Grid *grid, Box3d box) {                  \
+      fixed_update_e(grid, box, NY, NZ);                                       \
+    }
+  #define FIXED_INSTANTIATE(NY, NZ)                                            \
+    FIXED_KERNELS(avx2, "avx2", NY, NZ)                                        \
+    FIXED_KERNELS(avx512, "avx512f", NY, NZ)
+  #define FIXED_ENTRY(NY, NZ)                                                  \
+    {NY, NZ, SimdAVX2, update_h_avx2_##NY##x##NZ, update_e_avx2_##NY##x##NZ},  \
+        {NY, NZ, SimdAVX512, update_h_avx512_##NY##x##NZ,                      \
+         update_e_avx512_##NY##x##NZ},
+
+FDTD_FIXED_EXTENTS(FIXED_INSTANTIATE)
+#else
+  #define FIXED_ENTRY(NY, NZ)
+#endif
+
+// Terminated by an entry with ny == 0, which also keeps an empty list legal.
+static const FixedExtent fixed_extents[] = {
+    FDTD_FIXED_EXTENTS(FIXED_ENTRY){0},
+};
+
+static int fixed_select(const Grid *grid) {
+  if (grid->type != ThreeDimension || grid->param.materials > 0 ||
+      grid->param.padLines > 0 || grid->param.interleaved)
+    return -1;
+
+  for (int i = 0; fixed_extents[i].ny > 0; i++) {
+    const FixedExtent *fe = &fixed_extents[i];
+    if (fe->ny == grid->param.sizeY && fe->nz == grid->param.sizeZ &&
+        fe->simd == grid->simd && _fixed_sy(fe->nz) == grid->sy)
+      return i;
+  }
+  return -1;
+}
+
+/*
+ * Total-field/scattered-field corrections (Tfsf3d). Every sample next to the
+ * box surface whose curl reads a sample on the other side gets the incident
+ * value of that neighbour added or taken away: on the scattered side Hy on
+ * the x faces and Hx on the y faces (from Ez_inc), on the total side Ez on
+ * the x faces and Ex on the z faces (from Hy_inc). The eight faces are lists
+ * of rows along z, so each correction streams like a short sweep row.
+ * updateH/updateE apply them for step grid->time, the blocked and fused
+ * engines for the step they are on.
+ */
+typedef struct {
+  int   c;     // corrected component, 0..5 = ex..hz
+  Box3d cells; // corrected samples
+  int   sign;
+  int   shift; // table column = m + shift
+} TfsfFace;
+
+static void _tfsf_faces(const Tfsf3d *t, bool magnetic, TfsfFace face[4]) {
+  Box3d b = t->box;
+
+  if (magnetic) {
+    face[0] = (TfsfFace){4, {b.x0 - 1, b.x0, b.y0, b.y1, b.z0, b.z1 - 1},
+                         -1, 1 - b.x0};
+    face[1] = (TfsfFace){4, {b.x1 - 1, b.x1, b.y0, b.y1, b.z0, b.z1 - 1},
+                         1, -b.x0};
+    face[2] = (TfsfFace){3, {b.x0, b.x1, b.y0 - 1, b.y0, b.z0, b.z1 - 1},
+                         1, -b.x0};
+    face[3] = (TfsfFace){3, {b.x0, b.x1, b.y1 - 1, b.y1, b.z0, b.z1 - 1},
+                         -1, -b.x0};
+  } else {
+    face[0] = (TfsfFace){2, {b.x0, b.x0 + 1, b.y0, b.y1, b.z0, b.z1 - 1},
+                         -1, -b.x0};
+    face[1] = (TfsfFace){2, {b.x1 - 1, b.x1, b.y0, b.y1, b.z0, b.z1 - 1},
+                         1, 1 - b.x0};
+    face[2] = (TfsfFace){0, {b.x0, b.x1 - 1, b.y0, b.y1, b.z0, b.z0 + 1},
+                         1, 1 - b.x0};
+    face[3] = (TfsfFace){0, {b.x0, b.x1 - 1, b.y0, b.y1, b.z1 - 1, b.z1},
+                         -1, 1 - b.x0};
+  }
+}
+
+// f[i + k] += curl coefficient * v for k < n, whatever form the grid has.
+static void _tfsf_row(Grid *grid, int c, Real *f, size_t i, Accum v, int n) {
+  if (grid->param.materials > 0) {
+    const uint8_t *id[6] = {grid->mex, grid->mey, grid->mez,
+                            grid->mhx, grid->mhy, grid->mhz};
+    const Real    *cg    = c < 3 ? grid->mat_ceh : grid->mat_che;
+
+    for (int k = 0; k < n; k++) {
+      size_t j = i + k;
+      int    m = grid->mat_width == 2 ? ((const uint16_t *)id[c])[j]
+                                      : id[c][j];
+      f[j]     = (Real)(f[j] + cg[m] * v);
+    }
+    return;
+  }
+  if (grid->param.uniform) {
+    Accum g = (Accum)(c < 3 ? grid->ce : grid->ch) * v;
+    for (int k = 0; k < n; k++)
+      f[i + k] = (Real)(f[i + k] + g);
+    return;
+  }
+
+  const Real *cg[6] = {grid->cexh, grid->ceyh, grid->cezh,
+                       grid->chxe, grid->chye, grid->chze};
+  for (int k = 0; k < n; k++)
+    f[i + k] = (Real)(f[i + k] + cg[c][i + k] * v);
+}
+
+/*
+ * Applies the H (magnetic) or E corrections of step `time` to the samples
+ * inside box, right after the sweep that updated them.
+ */
+static void tfsf_box(Grid *grid, int time, Box3d box, bool magnetic) {
+  const Tfsf3d *t = grid->tfsf;
+
+  if (!t || time < 0 || time >= t->steps)
+    return;
+
+  uint64_t    t0  = PROF_BEGIN();
+  uint64_t    n   = 0;
+  const Real *inc = magnetic ? t->ez + (size_t)time * t->width
+                             : t->hy + (size_t)time * (t->width + 1);
+  Real       *f[6] = {grid->ex, grid->ey, grid->ez,
+                      grid->hx, grid->hy, grid->hz};
+  TfsfFace    face[4];
+
+  _tfsf_faces(t, magnetic, face);
+  for (int k = 0; k < 4; k++) {
+    Box3d c = _box_clip(face[k].cells, box);
+
+    if (_box_empty(c))
+      continue;
+    for (int mm = c.x0; mm < c.x1; mm++) {
+      Accum v = face[k].sign * (Accum)inc[mm + face[k].shift];
+
+      for (int nn = c.y0; nn < c.y1; nn++) {
+        _tfsf_row(grid, face[k].c, f[face[k].c],
+                  IDX3(mm, nn, c.z0, grid->sx, grid->sy), v, c.z1 - c.z0);
+        _periodic_touch(grid, face[k].c, f[face[k].c], mm, nn, c.z0, c.z1);
+      }
+    }
+    n += (uint64_t)(c.x1 - c.x0) * (c.y1 - c.y0) * (c.z1 - c.z0);
+  }
+  PROF_END(grid, ProfTfsf, t0, n);
+}
+
+// The samples a Tfsf3d writes, scattered-side faces included.
+static Box3d _tfsf_reach(const Tfsf3d *t) {
+  Box3d b = t->box;
+  return (Box3d){b.x0 - 1, b.x1, b.y0 - 1, b.y1, b.z0, b.z1};
+}
+
+/*
+ * Uses tfsf for grid, or with NULL stops using one. The box has to keep one
+ * sample clear of the grid edge on every side and be at least two nodes
+ * wide; it should also stay clear of absorbing layers and symmetry planes,
+ * which are not checked. The grid's cdtds and imp0 must be the table's.
+ */
+bool tfsf_attach(Grid *grid, const Tfsf3d *tfsf) {
+  if (!tfsf) {
+    grid->tfsf = NULL;
+    return true;
+  }
+  if (grid->type != ThreeDimension) {
+    fprintf(stderr, "[tfsf_attach] TFSF boxes are 3D only\n");
+    return false;
+  }
+
+  Box3d b = tfsf->box;
+  if (b.x0 < 1 || b.y0 < 1 || b.z0 < 1 || b.x1 > grid->param.sizeX - 1 ||
+      b.y1 > grid->param.sizeY - 1 || b.z1 > grid->param.sizeZ - 1 ||
+      b.x1 - b.x0 < 2 || b.y1 - b.y0 < 2 || b.z1 - b.z0 < 2) {
+    fprintf(stderr, "[tfsf_attach] box does not fit the grid\n");
+    return false;
+  }
+  if (tfsf->cdtds != grid->param.cdtds || tfsf->imp0 != grid->param.imp0) {
+    fprintf(stderr, "[tfsf_attach] table built for another cdtds or imp0\n");
+    return false;
+  }
+
+  grid->tfsf = tfsf;
+  grid_activate(grid, _tfsf_reach(tfsf));
+  return true;
+}
+
+/*
+ * Builds the incident table of a `type` waveform hard-sourced at x = 0 of
+ * the 1D grid and attaches it to grid. The 1D grid is long enough that the
+ * reflection off its far end cannot get back to x1 within maxTime steps, and
+ * since a plane wave along x sees exactly the 1D dispersion, the scattered
+ * region stays at zero in free space.
+ */
+bool tfsf_init(Grid *grid, Tfsf3d *tfsf, Box3d box, SourceType type,
+               SourceParameter param) {
+  *tfsf = (Tfsf3d){
+      .box   = box,
+      .steps = grid->param.maxTime,
+      .width = box.x1 - box.x0,
+      .cdtds = grid->param.cdtds,
+      .imp0  = grid->param.imp0,
+  };
+  if (tfsf->steps <= 0 || tfsf->width < 2) {
+    fprintf(stderr, "[tfsf_init] empty box or no time steps\n");
+    return false;
+  }
+
+  Grid line = {0};
+  if (!grid_init(&line, OneDimension,
+                 (GridParameter){
+                     .sizeX   = box.x1 + tfsf->steps / 2 + 3,
+                     .maxTime = tfsf->steps,
+                     .cdtds   = grid->param.cdtds,
+                     .imp0    = grid->param.imp0,
+                 }))
+    return false;
+
+  size_t w = (size_t)tfsf->width;
+  CALLOC(tfsf->ez, Real, tfsf->steps * w);
+  CALLOC(tfsf->hy, Real, tfsf->steps * (w + 1));
+
+  for (line.time = 0; line.time < tfsf->steps; line.time++) {
+    memcpy(tfsf->ez + line.time * w, line.ez + box.x0, w * sizeof(Real));
+    updateH(&line);
+    memcpy(tfsf->hy + line.time * (w + 1), line.hy + box.x0 - 1,
+           (w + 1) * sizeof(Real));
+    updateE(&line);
+    param.time = line.time;
+    line.ez[0] = (Real)ez_source_input(&line, type, param);
+  }
+  grid_free(&line);
+
+  if (!tfsf_attach(grid, tfsf)) {
+    tfsf_free(tfsf);
+    return false;
+  }
+  return true;
+}
+
+void tfsf_free(Tfsf3d *tfsf) {
+  FREE(tfsf->ez);
+  FREE(tfsf->hy);
+}
+
+/*
+ * Thin wires (Umashankar-Taflove). Within a cell of a wire much thinner than
+ * the cell, H around the wire and E across it fall off as 1/r, which the
+ * staircase cannot follow. Integrating Faraday's law over the face next to
+ * the wire with that profile gives the usual H update with the difference of
+ * the E along the wire scaled by 2 / ln(cell / radius), the E across the
+ * wire keeping its coefficient. wire_box adds (factor - 1) times that term
+ * to the four H samples circling each wire edge right after their update,
+ * from the same E samples the update read, and zeroes the wire's E after
+ * the E sweep; a feed gap keeps its E, which then stands in for the field
+ * on the wire surface.
+ */
+static inline bool _box_has(Box3d b, const int at[3]) {
+  return at[0] >= b.x0 && at[0] < b.x1 && at[1] >= b.y0 && at[1] < b.y1 &&
+         at[2] >= b.z0 && at[2] < b.z1;
+}
+
+static void wire_box(Grid *grid, Box3d box, bool magnetic) {
+  Real  *f[6] = {grid->ex, grid->ey, grid->ez, grid->hx, grid->hy, grid->hz};
+  size_t d[3] = {grid->sx, grid->sy, 1};
+
+  for (int w = 0; w < grid->wire_count; w++) {
+    const Wire *wire = &grid->wires[w];
+
+    if (_box_empty(_box_clip(wire->reach, box)))
+      continue;
+
+    int   a = wire->axis, b = (a + 1) % 3, c = (a + 2) % 3;
+    Real *e = f[a];
+    Accum k = (Accum)wire->factor - 1;
+
+    for (int s = 0; s < wire->length; s++) {
+      int at[3] = {wire->at[0], wire->at[1], wire->at[2]};
+      at[a] += s;
+      size_t i = IDX3(at[0], at[1], at[2], grid->sx, grid->sy);
+
+      if (!magnetic) {
+        if (s != wire->gap && _box_has(box, at)) {
+          e[i] = 0;
+          _periodic_touch(grid, a, e, at[0], at[1], at[2], at[2] + 1);
+        }
+        continue;
+      }
+      // H along c on either side across b, H along b on either side
+      // across c, with the signs the curl gives them.
+      for (int side = 0; side < 2; side++) {
+        int    hc[3] = {at[0], at[1], at[2]}, hb[3] = {at[0], at[1], at[2]};
+        size_t ic = i - side * d[b], ib = i - side * d[c];
+
+        hc[b] -= side;
+        hb[c] -= side;
+        if (_box_has(box, hc)) {
+          _tfsf_row(grid, 3 + c, f[3 + c], ic,
+                    k * ((Accum)e[ic + d[b]] - e[ic]), 1);
+          _periodic_touch(grid, 3 + c, f[3 + c], hc[0], hc[1], hc[2],
+                          hc[2] + 1);
+        }
+        if (_box_has(box, hb)) {
+          _tfsf_row(grid, 3 + b, f[3 + b], ib,
+                    -k * ((Accum)e[ib + d[c]] - e[ib]), 1);
+          _periodic_touch(grid, 3 + b, f[3 + b], hb[0], hb[1], hb[2],
+                          hb[2] + 1);
+        }
+      }
+    }
+  }
+}
+
+static inline bool _fixed_box(const Grid *grid, Box3d box) {
+  return grid->fixed >= 0 && box.z0 <= 0 && box.z1 >= grid->param.sizeZ;
+}
+
+/*
+ * One H or E phase on a box: the unit every engine (slabs and tiles, temporal
+ * blocks, the fused plane walk, the active region) is built from. Boundary,
+ * wire and symmetry work happens here or inside the row sweeps, right after
+ * the samples it touches are updated, so no engine needs an extra pass for
+ * it and the order an engine keeps for its boxes covers it as well.
+ */
+static void update_h_box(Grid *grid, Box3d box) {
+  BoundaryParam3d *b = grid->abc;
+
+  // Hx on a high x Mur face and Hy on a high y one are not swept, see
+  // BoundaryParam3d.
+  if (b && b->ey[1])
+    box.x1 = _min_int(box.x1, grid->param.sizeX - 1);
+  if (b && b->ex[3])
+    box.y1 = _min_int(box.y1, grid->param.sizeY - 1);
+  if (_fixed_box(grid, box))
+    fixed_extents[grid->fixed].h(grid, box);
+  else {
+    update_hx_3d(grid, box);
+    update_hy_3d(grid, box);
+    update_hz_3d(grid, box);
+  }
+  if (grid->wire_count > 0)
+    wire_box(grid, box, true);
+}
+
+static void update_e_box(Grid *grid, Box3d box) {
+  if (_fixed_box(grid, box))
+    fixed_extents[grid->fixed].e(grid, box);
+  else {
+    update_ex_3d(grid, box);
+    update_ey_3d(grid, box);
+    update_ez_3d(grid, box);
+  }
+  if (grid->wire_count > 0)
+    wire_box(grid, box, false);
+  if (grid->abc && _mirrored(grid->abc))
+    mirror_box(grid, box);
+}
+
+/*
+ * Cache-blocked traversal. With tileX/Y/Z set, a slab is walked tile by tile
+ * and all three components of a phase are finished on one tile before moving
+ * on, so the neighbour planes (mm + 1, nn + 1) a tile reads are still in L2
+ * when the next component needs them. A zero tile extent means "whole axis".
+ */
+static void grid_tiles_3d(Grid *grid, Box3d slab, SlabJob fn) {
+  int tx = grid->param.tileX > 0 ? grid->param.tileX : slab.x1 - slab.x0;
+  int ty = grid->param.tileY > 0 ? grid->param.tileY : slab.y1 - slab.y0;
+  int tz = grid->param.tileZ > 0 ? grid->param.tileZ : slab.z1 - slab.z0;
+
+  if (tx <= 0 || ty <= 0 || tz <= 0)
+    return;
+
+  for (int x0 = slab.x0; x0 < slab.x1; x0 += tx) {
+    for (int y0 = slab.y0; y0 < slab.y1; y0 += ty) {
+      for (int z0 = slab.z0; z0 < slab.z1; z0 += tz) {
+        fn(grid, (Box3d){
+                     .x0 = x0,
+                     .x1 = _min_int(x0 + tx, slab.x1),
+                     .y0 = y0,
+                     .y1 = _min_int(y0 + ty, slab.y1),
+                     .z0 = z0,
+                     .z1 = _min_int(z0 + tz, slab.z1),
+                 });
+      }
+    }
+  }
+}
+
+static void update_h_slab(Grid *grid, Box3d slab) {
+  grid_tiles_3d(grid, slab, update_h_box);
+  tfsf_box(grid, grid->time, slab, true);
+}
+
+static void update_e_slab(Grid *grid, Box3d slab) {
+  grid_tiles_3d(grid, slab, update_e_box);
+  tfsf_box(grid, grid->time, slab, false);
+}
+
+/*
+ * Temporal blocking. The leapfrog dependencies are H^s(m) <- E^s(m, m + 1)
+ * and E^s+1(m) <- H^s(m - 1, m), so after skewing x' = x + 2s, y' = y + 2s
+ * every dependence (and every anti-dependence of the in-place update) points
+ * to an equal or smaller (x', y'). Rectangular tiles in skewed space can
+ * therefore be advanced through `timeBlock` steps each while they are cache
+ * resident: per step the tile's box slides back by two cells in x and y, and
+ * H then E are updated on it. Tiles on one anti-diagonal are independent and
+ * are shared out across the pool.
+ */
+typedef struct {
+  int      time;
+  int      steps;
+  int      tx, ty;
+  int      nbx, nby;
+  int      diag;
+  StepHook hook;
+  void    *user;
+} TemporalBlock;
+
+static void temporal_tile(Grid *grid, const TemporalBlock *tb, int bx,
+                          int by) {
+  for (int s = 0; s < tb->steps; s++) {
+    Box3d box = {
+        .x0 = bx * tb->tx - 2 * s,
+        .x1 = (bx + 1) * tb->tx - 2 * s,
+        .y0 = by * tb->ty - 2 * s,
+        .y1 = (by + 1) * tb->ty - 2 * s,
+        .z0 = 0,
+        .z1 = grid->param.sizeZ,
+    };
+
+    update_h_box(grid, box);
+    tfsf_box(grid, tb->time + s, box, true);
+    update_e_box(grid, box);
+    tfsf_box(grid, tb->time + s, box, false);
+
+    if (tb->hook) {
+      box.x0 = _max_int(box.x0, 0);
+      box.x1 = _min_int(box.x1, grid->param.sizeX);
+      box.y0 = _max_int(box.y0, 0);
+      box.y1 = _min_int(box.y1, grid->param.sizeY);
+      if (box.x0 < box.x1 && box.y0 < box.y1)
+        tb->hook(grid, tb->time + s, box, tb->user);
+    }
+  }
+}
+
+static void _temporal_diag_job(Grid *grid, int worker, int count, void *ctx) {
+  const TemporalBlock *tb  = (const TemporalBlock *)ctx;
+  int                  bx0 = _max_int(0, tb->diag - (tb->nby - 1));
+  int                  bx1 = _min_int(tb->nbx - 1, tb->diag);
+
+  for (int bx = bx0 + worker; bx <= bx1; bx += count)
+    temporal_tile(grid, tb, bx, tb->diag - bx);
+}
+
+/*
+ * Periodic halos are filled between whole phases, which temporal blocks and
+ * the fused walk do not have; grids with a periodic axis are stepped one
+ * phase at a time instead. One half of a Bloch pair cannot be stepped on its
+ * own, the caller has to interleave updateH/updateE of both.
+ */
+static void _step_phases(Grid *grid, int steps, StepHook hook, void *user) {
+  NOB_ASSERT(!grid->abc->pair && "step a Bloch pair with updateH/updateE");
+  for (; steps > 0; steps--, grid->time++) {
+    updateH(grid);
+    updateE(grid);
+    if (hook)
+      hook(grid, grid->time, _grid_box(grid), user);
+  }
+}
+
+void grid_step_blocked(Grid *grid, int steps, StepHook hook, void *user) {
+  NOB_ASSERT(grid->type == ThreeDimension);
+  if (_periodic(grid)) {
+    _step_phases(grid, steps, hook, user);
+    return;
+  }
+  if (grid->param.activeRegion)
+    grid->active = _grid_box(grid);
+
+  int      k  = grid->param.timeBlock > 0 ? grid->param.timeBlock : 1;
+  int      tx = grid->param.tileX > 0 ? grid->param.tileX : grid->param.sizeX;
+  int      ty = grid->param.tileY > 0 ? grid->param.tileY : grid->param.sizeY;
+  uint64_t t0 = PROF_BEGIN();
+  uint64_t n  = (uint64_t)(steps > 0 ? steps : 0) * _grid_cells(grid);
+
+  while (steps > 0) {
+    TemporalBlock tb = {
+        .time  = grid->time,
+        .steps = _min_int(k, steps),
+        .tx    = tx,
+        .ty    = ty,
+        .hook  = hook,
+        .user  = user,
+    };
+    tb.nbx = (grid->param.sizeX + 2 * (tb.steps - 1) + tx - 1) / tx;
+    tb.nby = (grid->param.sizeY + 2 * (tb.steps - 1) + ty - 1) / ty;
+
+    for (tb.diag = 0; tb.diag < tb.nbx + tb.nby - 1; tb.diag++)
+      pool_run(grid, _temporal_diag_job, &tb);
+
+    grid->time += tb.steps;
+    steps -= tb.steps;
+  }
+
+  PROF_END(grid, ProfStepBlocked, t0, n);
+}
+
+/*
+ * Plane-streaming fused engine, the CPU counterpart of hardware/zplan.cpp.
+ * zplan walks z planes and updates H and then E on each plane, keeping the
+ * previous H plane (hx_prev1/hy_prev1) and the next E plane (ex_plus1/
+ * ey_plus1) in BRAM. Here the grid is walked along x, the slowest axis, and
+ * the rolling buffers are simply planes mm - 1 and mm + 1 of the field arrays
+ * themselves: H(mm) only reads E(mm) and the not yet updated E(mm + 1), and
+ * E(mm) only reads H(mm) and the already updated H(mm - 1). Inside a plane
+ * each row's E update follows its H update immediately, so every field is
+ * read and written once per step while three planes stay in cache.
+ *
+ * With a pool, worker w owns a y block and lags one plane behind worker
+ * w - 1, which is exactly the ordering the in-place update needs at block
+ * edges.
+ */
+typedef struct {
+  int      time;
+  int      stage;
+  StepHook hook;
+  void    *user;
+} FusedPass;
+
+static void fused_plane(Grid *grid, const FusedPass *fp, int mm, int y0,
+                        int y1) {
+  for (int nn = y0; nn < y1; nn++) {
+    Box3d row = {
+        .x0 = mm,
+        .x1 = mm + 1,
+        .y0 = nn,
+        .y1 = nn + 1,
+        .z0 = 0,
+        .z1 = grid->param.sizeZ,
+    };
+    update_h_box(grid, row);
+    tfsf_box(grid, fp->time, row, true);
+    update_e_box(grid, row);
+    tfsf_box(grid, fp->time, row, false);
+  }
+
+  if (fp->hook) {
+    fp->hook(grid, fp->time,
+             (Box3d){
+                 .x0 = mm,
+                 .x1 = mm + 1,
+                 .y0 = y0,
+                 .y1 = y1,
+                 .z0 = 0,
+                 .z1 = grid->param.sizeZ,
+             },
+             fp->user);
+  }
+}
+
+static void _fused_stage_job(Grid *grid, int worker, int count, void *ctx) {
+  const FusedPass *fp = (const FusedPass *)ctx;
+  int              mm = fp->stage - worker;
+  int              sy = grid->param.sizeY;
+
+  if (mm < 0 || mm >= grid->param.sizeX)
+    return;
+
+  fused_plane(grid, fp, mm, (int)((long long)sy * worker / count),
+              (int)((long long)sy * (worker + 1) / count));
+}
+
+void grid_step_fused(Grid *grid, int steps, StepHook hook, void *user) {
+  NOB_ASSERT(grid->type == ThreeDimension);
+  if (_periodic(grid)) {
+    _step_phases(grid, steps, hook, user);
+    return;
+  }
+  if (grid->param.activeRegion)
+    grid->active = _grid_box(grid);
+
+  int      workers = grid->pool ? grid->pool->count : 1;
+  uint64_t t0      = PROF_BEGIN();
+  uint64_t n       = (uint64_t)(steps > 0 ? steps : 0) * _grid_cells(grid);
+
+  for (; steps > 0; steps--, grid->time++) {
+    FusedPass fp = {.time = grid->time, .hook = hook, .user = user};
+
+    if (workers == 1) {
+      for (int mm = 0; mm < grid->param.sizeX; mm++)
+        fused_plane(grid, &fp, mm, 0, grid->param.sizeY);
+      continue;
+    }
+
+    for (fp.stage = 0; fp.stage < grid->param.sizeX + workers - 1; fp.stage++)
+      pool_run(grid, _fused_stage_job, &fp);
+  }
+
+  PROF_END(grid, ProfStepFused, t0, n);
+}
+
+void updateH(Grid *grid) {
+  int      mm, nn;
+  uint64_t t0;
+  switch (grid->type) {
+  case OneDimension:
+    for (mm = 0; mm < (grid->param.sizeX - 1); mm++) {
+      grid->hy[mm] = grid->chyh[mm] * grid->hy[mm] +
+                     grid->chye[mm] * (grid->ez[mm + 1] - grid->ez[mm]);
+    }
+    return;
+
+  case TwoDimensionMagnetic:
+    for (mm = 0; mm < grid->param.sizeX; mm++) {
+      for (nn = 0; nn < (grid->param.sizeY - 1); nn++) {
+        grid->hx[IDX2(mm, nn, (grid->param.sizeY - 1))] =
+            grid->chxh[IDX2(mm, nn, (grid->param.sizeY - 1))] *
+                grid->hx[IDX2(mm, nn, (grid->param.sizeY - 1))] -
+            grid->chxe[IDX2(mm, nn, (grid->param.sizeY - 1))] *
+                (grid->ez[IDX2(mm, nn + 1, (grid->param.sizeY))] -
+                 grid->ez[IDX2(mm, nn, (grid->param.sizeY))]);
+        // Hx(grid, mm, nn) = Chxh(grid, mm, nn) * Hx(grid, mm, nn) - Chxe(grid,
+        // mm, nn) * (Ez(grid, mm, nn + 1) - Ez(grid, mm, nn));
+      }
+    }
+    for (mm = 0; mm < (grid->param.sizeX - 1); mm++) {
+      for (nn = 0; nn < grid->param.sizeY; nn++) {
+        grid->hy[IDX2(mm, nn, (grid->param.sizeY))] =
             grid->chyh[IDX2(mm, nn, (grid->param.sizeY))] *
                 grid->hy[IDX2(mm, nn, (grid->param.sizeY))] +
             grid->chye[IDX2(mm, nn, grid->param.sizeY)] *
@@ -338,71 +3492,16 @@ void updateH(Grid *grid) {
     return;
 
   case ThreeDimension:
-    printf("updating hx\n");
-    for (mm = 0; mm < (grid->param.sizeX); mm++) {
-      for (nn = 0; nn < (grid->param.sizeY - 1); nn++) {
-        for (pp = 0; pp < (grid->param.sizeZ - 1); pp++) {
-          size_t idx_hx =
-              IDX3(mm, nn, pp, grid->param.sizeY - 1, grid->param.sizeZ - 1);
-          size_t idx_ey =
-              IDX3(mm, nn, pp, grid->param.sizeY - 1, grid->param.sizeZ);
-          size_t idx_ey_p =
-              IDX3(mm, nn, pp + 1, grid->param.sizeY - 1, grid->param.sizeZ);
-          size_t idx_ez =
-              IDX3(mm, nn, pp, grid->param.sizeY, grid->param.sizeZ - 1);
-          size_t idx_ez_p =
-              IDX3(mm, nn + 1, pp, grid->param.sizeY, grid->param.sizeZ - 1);
-          grid->hx[idx_hx] =
-              grid->chxh[idx_hx] * grid->hx[idx_hx] +
-              grid->chxe[idx_hx] * ((grid->ey[idx_ey_p] - grid->ey[idx_ey]) -
-                                    (grid->ez[idx_ez_p] - grid->ez[idx_ez]));
-        }
-      }
-    }
-    printf("updating hy\n");
-    for (mm = 0; mm < (grid->param.sizeX - 1); mm++) {
-      for (nn = 0; nn < (grid->param.sizeY); nn++) {
-        for (pp = 0; pp < (grid->param.sizeZ - 1); pp++) {
-          grid->hy[IDX3(mm, nn, pp, grid->param.sizeY, grid->param.sizeZ - 1)] =
-              grid->chyh[IDX3(mm, nn, pp, grid->param.sizeY,
-                              grid->param.sizeZ - 1)] *
-                  grid->hy[IDX3(mm, nn, pp, grid->param.sizeY,
-                                grid->param.sizeZ - 1)] +
-              grid->chye[IDX3(mm, nn, pp, grid->param.sizeY,
-                              grid->param.sizeZ - 1)] *
-                  ((grid->ez[IDX3(mm + 1, nn, pp, grid->param.sizeY,
-                                  grid->param.sizeZ - 1)] -
-                    grid->ez[IDX3(mm, nn, pp, grid->param.sizeY,
-                                  grid->param.sizeZ - 1)]) -
-                   (grid->ex[IDX3(mm, nn, pp + 1, grid->param.sizeY,
-                                  grid->param.sizeZ)] -
-                    grid->ex[IDX3(mm, nn, pp, grid->param.sizeY,
-                                  grid->param.sizeZ)]));
-        }
-      }
-    }
-    printf("updating hz\n");
-    for (mm = 0; mm < (grid->param.sizeX - 1); mm++) {
-      for (nn = 0; nn < (grid->param.sizeY - 1); nn++) {
-        for (pp = 0; pp < (grid->param.sizeZ); pp++) {
-          grid->hz[IDX3(mm, nn, pp, grid->param.sizeY - 1, grid->param.sizeZ)] =
-              grid->chzh[IDX3(mm, nn, pp, grid->param.sizeY - 1,
-                              grid->param.sizeZ)] *
-                  grid->hz[IDX3(mm, nn, pp, grid->param.sizeY - 1,
-                                grid->param.sizeZ)] +
-              grid->chze[IDX3(mm, nn, pp, grid->param.sizeY - 1,
-                              grid->param.sizeZ)] *
-                  ((grid->ex[IDX3(mm, nn + 1, pp, grid->param.sizeY,
-                                  grid->param.sizeZ)] -
-                    grid->ex[IDX3(mm, nn, pp, grid->param.sizeY,
-                                  grid->param.sizeZ)]) -
-                   (grid->ey[IDX3(mm + 1, nn, pp, grid->param.sizeY - 1,
-                                  grid->param.sizeZ)] -
-                    grid->ey[IDX3(mm, nn, pp, grid->param.sizeY - 1,
-                                  grid->param.sizeZ)]));
-        }
-      }
+    if (_periodic(grid)) {
+      t0 = PROF_BEGIN();
+      periodic_fill(grid, false);
+      PROF_END(grid, ProfBoundary, t0, 0);
     }
+    t0 = PROF_BEGIN();
+    if (grid->param.activeRegion)
+      grid_active_grow(grid);
+    grid_run_3d(grid, update_h_slab);
+    PROF_END(grid, ProfUpdateH, t0, _swept_cells(grid));
     return;
 
   default:
@@ -412,7 +3511,8 @@ void updateH(Grid *grid) {
 }
 
 void updateE(Grid *grid) {
-  int mm, nn, pp;
+  int      mm, nn;
+  uint64_t t0;
   switch (grid->type) {
   case OneDimension:
     for (mm = 1; mm < (grid->param.sizeX - 1); mm++) {
@@ -460,77 +3560,908 @@ void updateE(Grid *grid) {
     }
     return;
   case ThreeDimension:
-    printf("updating ex\n");
-    for (mm = 0; mm < (grid->param.sizeX - 1); mm++) {
-      for (nn = 1; nn < (grid->param.sizeY - 1); nn++) {
-        for (pp = 1; pp < (grid->param.sizeZ - 1); pp++) {
-          grid->ex[IDX3(mm, nn, pp, grid->param.sizeY, grid->param.sizeZ)] =
-              grid->cexe[IDX3(mm, nn, pp, grid->param.sizeY,
-                              grid->param.sizeZ)] *
-                  grid->ex[IDX3(mm, nn, pp, grid->param.sizeY,
-                                grid->param.sizeZ)] +
-              grid->cexh[IDX3(mm, nn, pp, grid->param.sizeY,
-                              grid->param.sizeZ)] *
-                  ((grid->hz[IDX3(mm, nn, pp, grid->param.sizeY - 1,
-                                  grid->param.sizeZ)] -
-                    grid->hz[IDX3(mm, nn - 1, pp, grid->param.sizeY - 1,
-                                  grid->param.sizeZ)]) -
-                   (grid->hy[IDX3(mm, nn, pp, grid->param.sizeY,
-                                  grid->param.sizeZ - 1)] -
-                    grid->hy[IDX3(mm, nn, pp - 1, grid->param.sizeY,
-                                  grid->param.sizeZ - 1)]));
-        }
-      }
+    if (_periodic(grid)) {
+      t0 = PROF_BEGIN();
+      periodic_fill(grid, true);
+      PROF_END(grid, ProfBoundary, t0, 0);
     }
-    printf("updating ey\n");
-    for (mm = 1; mm < (grid->param.sizeX - 1); mm++) {
-      for (nn = 0; nn < (grid->param.sizeY - 1); nn++) {
-        for (pp = 1; pp < (grid->param.sizeZ - 1); pp++) {
-          grid->ey[IDX3(mm, nn, pp, grid->param.sizeY - 1, grid->param.sizeZ)] =
-              grid->ceye[IDX3(mm, nn, pp, grid->param.sizeY - 1,
-                              grid->param.sizeZ)] *
-                  grid->ey[IDX3(mm, nn, pp, grid->param.sizeY - 1,
-                                grid->param.sizeZ)] +
-              grid->ceyh[IDX3(mm, nn, pp, grid->param.sizeY - 1,
-                              grid->param.sizeZ)] *
-                  ((grid->hx[IDX3(mm, nn, pp, grid->param.sizeY - 1,
-                                  grid->param.sizeZ - 1)] -
-                    grid->hx[IDX3(mm, nn, pp - 1, grid->param.sizeY - 1,
-                                  grid->param.sizeZ - 1)]) -
-                   (grid->hz[IDX3(mm, nn, pp, grid->param.sizeY - 1,
-                                  grid->param.sizeZ)] -
-                    grid->hz[IDX3(mm - 1, nn, pp, grid->param.sizeY - 1,
-                                  grid->param.sizeZ)]));
-        }
+    t0 = PROF_BEGIN();
+    grid_run_3d(grid, update_e_slab);
+    PROF_END(grid, ProfUpdateE, t0, _swept_cells(grid));
+    return;
+  default:
+    NOB_UNREACHABLE("updateE");
+    return;
+  }
+}
+
+/*
+ * Waveform of a soft source at param.time, delayed by param.location cells:
+ * a Gaussian pulse ppw cells wide peaking three widths in, a sine of ppw
+ * cells per wavelength, or a Ricker wavelet of ppw points per wavelength at
+ * its peak frequency. An Impulse is 1 at step 0 and 0 after, with neither
+ * delay nor ppw.
+ */
+static double _source_value(double cdtds, SourceType type,
+                            SourceParameter param) {
+  double x = cdtds * param.time - param.location;
+  double arg;
+
+  switch (type) {
+  case GaussianPulse:
+    arg = x / param.ppw - 3.0;
+    return exp(-arg * arg);
+  case HarmonicSources:
+    return sin(2.0 * M_PI * x / param.ppw);
+  case RickerWavelet:
+    arg = M_PI * (x / param.ppw - 1.0);
+    arg *= arg;
+    return (1.0 - 2.0 * arg) * exp(-arg);
+  case Impulse:
+    return param.time == 0 ? 1.0 : 0.0;
+  default:
+    NOB_UNREACHABLE("ez_source_input");
+    return 0.0;
+  }
+}
+
+double ez_source_input(Grid *grid, SourceType type, SourceParameter param) {
+  return _source_value(grid->param.cdtds, type, param);
+}
+
+/*
+ * Tabulated soft sources. A run usually drives many cells with a handful of
+ * waveforms, so source_finish evaluates each waveform once per step up front
+ * and source_inject only gathers from the table: per cell one multiply-add
+ * instead of an exp or sin. Build a set with source_wave and source_add,
+ * then source_finish before the first source_inject.
+ */
+
+// Adds a waveform column to the table, returns its index or -1.
+int source_wave(Grid *grid, SourceSet *set, SourceType type,
+                SourceParameter param) {
+  if (type != Impulse && param.ppw <= 0) {
+    fprintf(stderr, "[source_wave] ppw must be positive\n");
+    return -1;
+  }
+
+  set->wave = realloc(set->wave, (set->waves + 1) * sizeof(SourceWave));
+  if (!set->wave) {
+    fprintf(stderr, "[ERROR] Allocation failed for source waveforms.\n");
+    abort();
+  }
+  set->wave[set->waves] = (SourceWave){type, param};
+  set->steps            = grid->param.maxTime;
+  set->cdtds            = grid->param.cdtds;
+  FREE(set->table);
+  return set->waves++;
+}
+
+// Adds amp times waveform `wave` to component c (0..5 = ex..hz) at (m,n,p).
+bool source_add(Grid *grid, SourceSet *set, int wave, int c, int m, int n,
+                int p, double amp) {
+  if (c < 0 || c >= 6 || wave < 0 || wave >= set->waves) {
+    fprintf(stderr, "[source_add] bad component or waveform\n");
+    return false;
+  }
+  if (m < 0 || m >= grid->param.sizeX || n < 0 || n >= grid->param.sizeY ||
+      p < 0 || p >= grid->param.sizeZ) {
+    fprintf(stderr, "[source_add] cell (%d, %d, %d) outside the grid\n", m, n,
+            p);
+    return false;
+  }
+
+  SourceCells *cells = &set->cells[c];
+  int          i     = cells->count++;
+
+  cells->offset = realloc(cells->offset, cells->count * sizeof(size_t));
+  cells->wave   = realloc(cells->wave, cells->count * sizeof(int));
+  cells->amp    = realloc(cells->amp, cells->count * sizeof(Real));
+  if (!cells->offset || !cells->wave || !cells->amp) {
+    fprintf(stderr, "[ERROR] Allocation failed for source cells.\n");
+    abort();
+  }
+  cells->offset[i] = IDX3(m, n, p, grid->sx, grid->sy);
+  cells->wave[i]   = wave;
+  cells->amp[i]    = (Real)amp;
+  return true;
+}
+
+typedef struct {
+  size_t offset;
+  int    index;
+} SourceKey;
+
+// By offset, then insertion order, so repeated cells add up as added.
+static int _source_cmp(const void *a, const void *b) {
+  const SourceKey *x = a, *y = b;
+
+  if (x->offset != y->offset)
+    return x->offset < y->offset ? -1 : 1;
+  return (x->index > y->index) - (x->index < y->index);
+}
+
+/*
+ * Tabulates the recorded waveforms, one row of `waves` values per step, and
+ * sorts the cells of every component by offset, which lets source_inject
+ * find the cells of a box by binary search and walk the field in address
+ * order.
+ */
+void source_finish(SourceSet *set) {
+  if (set->wave && !set->table) {
+    CALLOC(set->table, Real, (size_t)set->steps * set->waves);
+    for (int w = 0; w < set->waves; w++) {
+      SourceParameter param = set->wave[w].param;
+
+      for (int t = 0; t < set->steps; t++) {
+        param.time                             = t;
+        set->table[(size_t)t * set->waves + w] =
+            (Real)_source_value(set->cdtds, set->wave[w].type, param);
       }
     }
-    printf("updating ez\n");
-    for (mm = 1; mm < (grid->param.sizeX - 1); mm++) {
-      for (nn = 1; nn < (grid->param.sizeY - 1); nn++) {
-        for (pp = 0; pp < (grid->param.sizeZ - 1); pp++) {
-          grid->ez[IDX3(mm, nn, pp, grid->param.sizeY, grid->param.sizeZ - 1)] =
-              grid->ceze[IDX3(mm, nn, pp, grid->param.sizeY,
-                              grid->param.sizeZ - 1)] *
-                  grid->ez[IDX3(mm, nn, pp, grid->param.sizeY,
-                                grid->param.sizeZ - 1)] +
-              grid->cezh[IDX3(mm, nn, pp, grid->param.sizeY,
-                              grid->param.sizeZ - 1)] *
-                  ((grid->hy[IDX3(mm, nn, pp, grid->param.sizeY,
-                                  grid->param.sizeZ - 1)] -
-                    grid->hy[IDX3(mm - 1, nn, pp, grid->param.sizeY,
-                                  grid->param.sizeZ - 1)]) -
-                   (grid->hx[IDX3(mm, nn, pp, grid->param.sizeY - 1,
-                                  grid->param.sizeZ - 1)] -
-                    grid->hx[IDX3(mm, nn - 1, pp, grid->param.sizeY - 1,
-                                  grid->param.sizeZ - 1)]));
-        }
+  }
+
+  set->unique = true;
+
+  for (int c = 0; c < 6; c++) {
+    SourceCells *cells = &set->cells[c];
+    int          n     = cells->count;
+    SourceKey   *key;
+    int         *wave;
+    Real        *amp;
+
+    if (n == 0)
+      continue;
+    CALLOC(key, SourceKey, n);
+    CALLOC(wave, int, n);
+    CALLOC(amp, Real, n);
+    for (int i = 0; i < n; i++)
+      key[i] = (SourceKey){cells->offset[i], i};
+    qsort(key, n, sizeof(SourceKey), _source_cmp);
+
+    for (int i = 0; i < n; i++) {
+      cells->offset[i] = key[i].offset;
+      wave[i]          = cells->wave[key[i].index];
+      amp[i]           = cells->amp[key[i].index];
+      if (i > 0 && key[i].offset == key[i - 1].offset)
+        set->unique = false;
+    }
+
+    free(key);
+    FREE(cells->wave);
+    FREE(cells->amp);
+    cells->wave = wave;
+    cells->amp  = amp;
+  }
+}
+
+// First cell at or after offset `at`.
+static int _source_lower(const SourceCells *cells, size_t at) {
+  int lo = 0, hi = cells->count;
+
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (cells->offset[mid] < at)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+static void _source_range(const SourceCells *cells, SourceRow row, Real *f,
+                          const Real *values, size_t begin, size_t end) {
+  int i = _source_lower(cells, begin);
+  int j = _source_lower(cells, end);
+
+  if (j > i)
+    row(f, cells->offset + i, cells->wave + i, cells->amp + i, values, j - i);
+}
+
+/*
+ * Adds the step `time` values of the E (or with magnetic the H) sources
+ * inside box, so a StepHook passes its own box and every cell is injected
+ * exactly once per step whatever the engine. Steps outside the table add
+ * nothing.
+ */
+void source_inject(Grid *grid, const SourceSet *set, bool magnetic, int time,
+                   Box3d box) {
+  if (time < 0 || time >= set->steps)
+    return;
+
+  uint64_t    t0     = PROF_BEGIN();
+  const Real *values = set->table + (size_t)time * set->waves;
+  SourceRow   row    = set->unique ? grid->source_row : source_row_scalar;
+  Real       *f[6]   = {grid->ex, grid->ey, grid->ez,
+                        grid->hx, grid->hy, grid->hz};
+  size_t      sx = grid->sx, sy = grid->sy;
+  bool full_z  = box.z0 <= 0 && box.z1 >= grid->param.sizeZ;
+  bool full_yz = full_z && box.y0 <= 0 && box.y1 >= grid->param.sizeY;
+  int  cells   = 0;
+
+  for (int c = magnetic ? 3 : 0; c < (magnetic ? 6 : 3); c++) {
+    const SourceCells *src = &set->cells[c];
+
+    if (src->count == 0)
+      continue;
+    cells += src->count;
+    if (full_yz && box.x0 <= 0 && box.x1 >= grid->param.sizeX) {
+      row(f[c], src->offset, src->wave, src->amp, values, src->count);
+      continue;
+    }
+
+    // Offsets grow with (m, n, p): one range per plane, or per row.
+    for (int mm = box.x0; mm < box.x1; mm++) {
+      if (full_yz) {
+        _source_range(src, row, f[c], values, IDX3(mm, 0, 0, sx, sy),
+                      IDX3(mm + 1, 0, 0, sx, sy));
+        continue;
       }
+      for (int nn = box.y0; nn < box.y1; nn++)
+        if (full_z)
+          _source_range(src, row, f[c], values, IDX3(mm, nn, 0, sx, sy),
+                        IDX3(mm, nn + 1, 0, sx, sy));
+        else
+          _source_range(src, row, f[c], values, IDX3(mm, nn, box.z0, sx, sy),
+                        IDX3(mm, nn, box.z1, sx, sy));
+    }
+  }
+  PROF_END(grid, ProfSource, t0, cells);
+}
+
+void source_free(SourceSet *set) {
+  for (int c = 0; c < 6; c++) {
+    FREE(set->cells[c].offset);
+    FREE(set->cells[c].wave);
+    FREE(set->cells[c].amp);
+  }
+  FREE(set->wave);
+  FREE(set->table);
+  *set = (SourceSet){0};
+}
+
+/*
+ * Impulse responses. The update is linear and time invariant, so a run
+ * whose sources all carry the Impulse waveform records, at every probe, the
+ * response h to a unit sample at step 0. The response to any other
+ * waveform s of the same sources is then the convolution
+ * y[t] = sum_k s[k] h[t - k], and impulse_convolve computes it with FFTs in
+ * O(T log T) per probe instead of another simulation. This holds for soft
+ * sources (SourceSet) and TFSF boxes alike, the latter with an Impulse
+ * incident table.
+ */
+
+// Extent of component c along each axis, as in the sweeps.
+static void _component_extent(const Grid *grid, int c, int N[3]) {
+  N[0] = grid->param.sizeX - (c == 0 || c == 4 || c == 5);
+  N[1] = grid->param.sizeY - (c == 1 || c == 3 || c == 5);
+  N[2] = grid->param.sizeZ - (c == 2 || c == 3 || c == 4);
+}
+
+bool probe_add(Grid *grid, ProbeSet *set, int c, int m, int n, int p) {
+  int N[3];
+
+  if (c < 0 || c >= 6) {
+    fprintf(stderr, "[probe_add] bad component %d\n", c);
+    return false;
+  }
+  _component_extent(grid, c, N);
+  if (m < 0 || m >= N[0] || n < 0 || n >= N[1] || p < 0 || p >= N[2]) {
+    fprintf(stderr, "[probe_add] sample (%d, %d, %d) outside component %d\n",
+            m, n, p, c);
+    return false;
+  }
+
+  set->probe = realloc(set->probe, (set->count + 1) * sizeof(Probe));
+  if (!set->probe) {
+    fprintf(stderr, "[ERROR] Allocation failed for probes.\n");
+    abort();
+  }
+  set->probe[set->count++] = (Probe){
+      .c      = c,
+      .m      = m,
+      .n      = n,
+      .p      = p,
+      .offset = IDX3(m, n, p, grid->sx, grid->sy),
+  };
+  return true;
+}
+
+// Every sample of component c on the plane `index` normal to axis (0..2).
+bool probe_plane(Grid *grid, ProbeSet *set, int c, int axis, int index) {
+  int N[3];
+
+  if (c < 0 || c >= 6 || axis < 0 || axis >= 3) {
+    fprintf(stderr, "[probe_plane] bad component or axis\n");
+    return false;
+  }
+  _component_extent(grid, c, N);
+  if (index < 0 || index >= N[axis]) {
+    fprintf(stderr, "[probe_plane] plane %d outside component %d\n", index,
+            c);
+    return false;
+  }
+
+  int u = (axis + 1) % 3, v = (axis + 2) % 3;
+  for (int i = 0; i < N[u]; i++) {
+    for (int j = 0; j < N[v]; j++) {
+      int at[3];
+      at[axis] = index;
+      at[u]    = i;
+      at[v]    = j;
+      probe_add(grid, set, c, at[0], at[1], at[2]);
     }
+  }
+  return true;
+}
+
+typedef struct {
+  int m;
+  int index;
+} ProbeKey;
+
+static int _probe_cmp(const void *a, const void *b) {
+  const ProbeKey *x = a, *y = b;
+
+  if (x->m != y->m)
+    return x->m < y->m ? -1 : 1;
+  return (x->index > y->index) - (x->index < y->index);
+}
+
+// Allocates maxTime samples per probe and sorts the probes for recording.
+void probe_finish(Grid *grid, ProbeSet *set) {
+  FREE(set->order);
+  FREE(set->data);
+  set->steps = grid->param.maxTime;
+  if (set->count == 0 || set->steps <= 0)
     return;
-  default:
-    NOB_UNREACHABLE("updateE");
+
+  ProbeKey *key;
+  CALLOC(key, ProbeKey, set->count);
+  CALLOC(set->order, int, set->count);
+  CALLOC(set->data, Real, (size_t)set->count * set->steps);
+  for (int i = 0; i < set->count; i++)
+    key[i] = (ProbeKey){set->probe[i].m, i};
+  qsort(key, set->count, sizeof(ProbeKey), _probe_cmp);
+  for (int i = 0; i < set->count; i++)
+    set->order[i] = key[i].index;
+  free(key);
+}
+
+/*
+ * Stores the samples of step `time` inside box, so that like source_inject
+ * it works from a StepHook as well as after updateE; call it after the
+ * sources of the step.
+ */
+void probe_record(Grid *grid, ProbeSet *set, int time, Box3d box) {
+  if (time < 0 || time >= set->steps)
     return;
+
+  const Real *f[6] = {grid->ex, grid->ey, grid->ez,
+                      grid->hx, grid->hy, grid->hz};
+  int         lo = 0, hi = set->count;
+
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (set->probe[set->order[mid]].m < box.x0)
+      lo = mid + 1;
+    else
+      hi = mid;
   }
+
+  for (int k = lo; k < set->count; k++) {
+    int          i  = set->order[k];
+    const Probe *pr = &set->probe[i];
+
+    if (pr->m >= box.x1)
+      break;
+    if (pr->n < box.y0 || pr->n >= box.y1 || pr->p < box.z0 ||
+        pr->p >= box.z1)
+      continue;
+    set->data[(size_t)i * set->steps + time] = f[pr->c][pr->offset];
+  }
+}
+
+void probe_free(ProbeSet *set) {
+  FREE(set->probe);
+  FREE(set->order);
+  FREE(set->data);
+  *set = (ProbeSet){0};
+}
+
+// In-place radix-2 FFT of n (a power of two) interleaved complex values.
+static void _fft(double *z, int n, bool inverse) {
+  for (int i = 1, j = 0; i < n; i++) {
+    int bit = n >> 1;
+    for (; j & bit; bit >>= 1)
+      j ^= bit;
+    j ^= bit;
+    if (i < j) {
+      double re = z[2 * i], im = z[2 * i + 1];
+      z[2 * i]     = z[2 * j];
+      z[2 * i + 1] = z[2 * j + 1];
+      z[2 * j]     = re;
+      z[2 * j + 1] = im;
+    }
+  }
+
+  for (int len = 2; len <= n; len <<= 1) {
+    double a  = (inverse ? 2.0 : -2.0) * M_PI / len;
+    double wr = cos(a), wi = sin(a);
+
+    for (int i = 0; i < n; i += len) {
+      double cr = 1.0, ci = 0.0;
+      for (int k = 0; k < len / 2; k++) {
+        double *u  = z + 2 * (i + k), *v = z + 2 * (i + k + len / 2);
+        double  vr = v[0] * cr - v[1] * ci;
+        double  vi = v[0] * ci + v[1] * cr;
+        v[0]       = u[0] - vr;
+        v[1]       = u[1] - vi;
+        u[0] += vr;
+        u[1] += vi;
+
+        double t = cr * wr - ci * wi;
+        ci       = cr * wi + ci * wr;
+        cr       = t;
+      }
+    }
+  }
+}
+
+/*
+ * Fills out (count x steps, in probe order) with the response of every
+ * probe of an impulse run to the `type` waveform, evaluated as the run's
+ * sources would have evaluated it. Two real responses share each complex
+ * transform, as real and imaginary part.
+ */
+bool impulse_convolve(Grid *grid, const ProbeSet *impulse, SourceType type,
+                      SourceParameter param, double *out) {
+  int T = impulse->steps, n = 1;
+
+  if (!impulse->data || T <= 0) {
+    fprintf(stderr, "[impulse_convolve] nothing recorded\n");
+    return false;
+  }
+  while (n < 2 * T)
+    n <<= 1;
+
+  double *s, *z;
+  CALLOC(s, double, 2 * (size_t)n);
+  CALLOC(z, double, 2 * (size_t)n);
+
+  for (int t = 0; t < T; t++) {
+    param.time = t;
+    s[2 * t]   = (Real)ez_source_input(grid, type, param);
+  }
+  _fft(s, n, false);
+
+  for (int i = 0; i < impulse->count; i += 2) {
+    const Real *h0 = impulse->data + (size_t)i * T;
+    const Real *h1 = i + 1 < impulse->count ? h0 + T : NULL;
+
+    memset(z, 0, 2 * (size_t)n * sizeof(double));
+    for (int t = 0; t < T; t++) {
+      z[2 * t]     = h0[t];
+      z[2 * t + 1] = h1 ? h1[t] : 0.0;
+    }
+    _fft(z, n, false);
+    for (int k = 0; k < n; k++) {
+      double re    = z[2 * k] * s[2 * k] - z[2 * k + 1] * s[2 * k + 1];
+      z[2 * k + 1] = z[2 * k] * s[2 * k + 1] + z[2 * k + 1] * s[2 * k];
+      z[2 * k]     = re;
+    }
+    _fft(z, n, true);
+
+    for (int t = 0; t < T; t++) {
+      out[(size_t)i * T + t] = z[2 * t] / n;
+      if (h1)
+        out[(size_t)(i + 1) * T + t] = z[2 * t + 1] / n;
+    }
+  }
+
+  free(s);
+  free(z);
+  return true;
+}
+
+/*
+ * Multi-port characterisation in one run. A port is a resistor R in series
+ * with a voltage source Vs across one E edge, folded into that edge's
+ * update like a conductivity (Taflove's resistive voltage source):
+ *
+ *   E' = (1 - L) / (1 + L) E + cg / (1 + L) curl H - 2 L / (1 + L) Vs,
+ *   L  = cg / (2 R),
+ *
+ * with cg the edge's curl coefficient; the gap is taken to be lossless. The
+ * port voltage is V = -E averaged over the step and the current I the loop
+ * integral of H around the edge, i.e. the current into the structure at
+ * the port. Every port sees the others as matched loads.
+ *
+ * port_finish gives port j Gaussian-modulated sines centred on its
+ * sub-bands, wide enough that a neighbour's spectrum is down by 1e-6 at
+ * the centre of the next sub-band, where the DFT monitors sit. So at every
+ * monitor frequency a single port is driving, and the response of all
+ * ports there is one column of the scattering matrix. port_matrix puts the
+ * columns of one slot together, each interpolated to the slot centre from
+ * its own two nearest sub-bands. Narrower sub-bands (more `bands`) need
+ * longer pulses but bring the columns closer together; the run has to last
+ * until the structure has rung down, as for a single broadband port.
+ */
+bool port_add(Grid *grid, PortSet *set, int c, int m, int n, int p,
+              double resistance) {
+  int N[3];
+
+  if (grid->type != ThreeDimension || grid->param.uniform ||
+      grid->param.materials > 0) {
+    fprintf(stderr, "[port_add] ports need a 3D grid with coefficient "
+                    "arrays\n");
+    return false;
+  }
+  if (c < 0 || c >= 3 || resistance <= 0.0) {
+    fprintf(stderr, "[port_add] bad component or resistance\n");
+    return false;
+  }
+  _component_extent(grid, c, N);
+  if (m < (c != 0) || m >= N[0] - (c != 0) || n < (c != 1) ||
+      n >= N[1] - (c != 1) || p < (c != 2) || p >= N[2] - (c != 2)) {
+    fprintf(stderr, "[port_add] edge (%d, %d, %d) not inside the grid\n", m,
+            n, p);
+    return false;
+  }
+
+  Real  *cf[3] = {grid->cexe, grid->ceye, grid->ceze};
+  Real  *cg[3] = {grid->cexh, grid->ceyh, grid->cezh};
+  size_t i     = IDX3(m, n, p, grid->sx, grid->sy);
+  double L     = cg[c][i] / (2.0 * resistance);
+
+  for (int j = 0; j < set->count; j++)
+    if (set->port[j].c == c && set->port[j].offset == i) {
+      fprintf(stderr, "[port_add] edge (%d, %d, %d) already has a port\n",
+              m, n, p);
+      return false;
+    }
+
+  set->port = realloc(set->port, (set->count + 1) * sizeof(Port));
+  if (!set->port) {
+    fprintf(stderr, "[ERROR] Allocation failed for ports.\n");
+    abort();
+  }
+  set->port[set->count++] = (Port){
+      .c          = c,
+      .m          = m,
+      .n          = n,
+      .p          = p,
+      .offset     = i,
+      .resistance = resistance,
+      .drive      = -2.0 * L / (1.0 + L),
+      .cf         = cf[c][i],
+      .cg         = cg[c][i],
+  };
+  cf[c][i] = (Real)((1.0 - L) / (1.0 + L));
+  cg[c][i] = (Real)(cg[c][i] / (1.0 + L));
+  return true;
+}
+
+/*
+ * Assigns the bands over [fmin, fmax] (cycles per step, cdtds / ppw for ppw
+ * cells per wavelength) and builds the source waveforms for maxTime steps.
+ */
+bool port_finish(Grid *grid, PortSet *set, double fmin, double fmax,
+                 int bands) {
+  int N = set->count, T = grid->param.maxTime;
+
+  if (N == 0 || bands < 1 || fmin < 0.0 || fmax <= fmin || fmax > 0.5) {
+    fprintf(stderr, "[port_finish] no ports or bad band\n");
+    return false;
+  }
+
+  double B   = (fmax - fmin) / (bands * N);
+  double tau = sqrt(log(1e6)) / (M_PI * B);
+  double t0  = 4.0 * tau;
+
+  if (T < 2.0 * t0)
+    fprintf(stderr,
+            "[port_finish] warning: %d steps, the pulses last %.0f\n", T,
+            2.0 * t0);
+
+  set->bands = bands;
+  set->freqs = bands * N;
+  CALLOC(set->freq, double, set->freqs);
+  CALLOC(set->v, double, 2 * (size_t)N * set->freqs);
+  CALLOC(set->i, double, 2 * (size_t)N * set->freqs);
+  for (int k = 0; k < set->freqs; k++)
+    set->freq[k] = fmin + (k + 0.5) * B;
+
+  // One column per port, sampled at t + 1/2 like the E update needs it.
+  SourceSet *src = &set->source;
+  CALLOC(src->table, Real, (size_t)T * N);
+  src->steps = T;
+  src->waves = N;
+  for (int t = 0; t < T; t++) {
+    double x   = t + 0.5 - t0;
+    double env = exp(-(x / tau) * (x / tau));
+
+    for (int j = 0; j < N; j++) {
+      double w = 0.0;
+      for (int k = j; k < set->freqs; k += N)
+        w += sin(2.0 * M_PI * set->freq[k] * (t + 0.5));
+      src->table[(size_t)t * N + j] = (Real)(env * w);
+    }
+  }
+
+  // The ports drive their edges from step 0, wherever the field is.
+  for (int j = 0; j < N; j++) {
+    const Port *pt = &set->port[j];
+    source_add(grid, src, j, pt->c, pt->m, pt->n, pt->p, pt->drive);
+    grid_activate(grid, (Box3d){pt->m, pt->m + 1, pt->n, pt->n + 1, pt->p,
+                                pt->p + 1});
+  }
+  source_finish(src);
+  return true;
+}
+
+// Drives the ports of step `time` inside box and adds them to the DFTs.
+void port_step(Grid *grid, PortSet *set, int time, Box3d box) {
+  source_inject(grid, &set->source, false, time, box);
+
+  Real  *f[6] = {grid->ex, grid->ey, grid->ez, grid->hx, grid->hy, grid->hz};
+  size_t d[3] = {grid->sx, grid->sy, 1};
+
+  for (int j = 0; j < set->count; j++) {
+    Port *pt = &set->port[j];
+
+    if (pt->m < box.x0 || pt->m >= box.x1 || pt->n < box.y0 ||
+        pt->n >= box.y1 || pt->p < box.z0 || pt->p >= box.z1)
+      continue;
+
+    // Curl of H around the edge, as in the update of component c.
+    int    a = (pt->c + 1) % 3, b = (pt->c + 2) % 3;
+    size_t o = pt->offset;
+    double I = ((double)f[3 + b][o] - f[3 + b][o - d[a]]) -
+               ((double)f[3 + a][o] - f[3 + a][o - d[b]]);
+    double E = -(double)f[pt->c][o];
+    double V = 0.5 * (E + pt->prev);
+
+    pt->prev = E;
+    for (int k = 0; k < set->freqs; k++) {
+      double  ph = -2.0 * M_PI * set->freq[k] * (time + 0.5);
+      double  cr = cos(ph), ci = sin(ph);
+      double *v  = set->v + 2 * ((size_t)j * set->freqs + k);
+      double *i  = set->i + 2 * ((size_t)j * set->freqs + k);
+
+      v[0] += V * cr;
+      v[1] += V * ci;
+      i[0] += I * cr;
+      i[1] += I * ci;
+    }
+  }
+}
+
+// X = Y M^-1 for n x n complex (re, im) matrices; false if M is singular.
+static bool _cmat_rdiv(int n, const double *Y, const double *M, double *X) {
+  int     w = 2 * n;
+  double *a;
+  bool    ok = true;
+
+  // Rows of [M^T | Y^T], reduced to [1 | X^T].
+  CALLOC(a, double, (size_t)n * 2 * w);
+  for (int r = 0; r < n; r++) {
+    for (int c = 0; c < n; c++) {
+      a[r * 2 * w + 2 * c]         = M[2 * (c * n + r)];
+      a[r * 2 * w + 2 * c + 1]     = M[2 * (c * n + r) + 1];
+      a[r * 2 * w + w + 2 * c]     = Y[2 * (c * n + r)];
+      a[r * 2 * w + w + 2 * c + 1] = Y[2 * (c * n + r) + 1];
+    }
+  }
+
+  for (int c = 0; c < n && ok; c++) {
+    int piv = c;
+    for (int r = c + 1; r < n; r++)
+      if (hypot(a[r * 2 * w + 2 * c], a[r * 2 * w + 2 * c + 1]) >
+          hypot(a[piv * 2 * w + 2 * c], a[piv * 2 * w + 2 * c + 1]))
+        piv = r;
+    for (int k = 0; k < 2 * w; k++) {
+      double t           = a[c * 2 * w + k];
+      a[c * 2 * w + k]   = a[piv * 2 * w + k];
+      a[piv * 2 * w + k] = t;
+    }
+
+    double pr = a[c * 2 * w + 2 * c], pi = a[c * 2 * w + 2 * c + 1];
+    double pm = pr * pr + pi * pi;
+    if (pm == 0.0) {
+      ok = false;
+      break;
+    }
+    for (int k = 0; k < w; k++) {
+      double *z  = a + c * 2 * w + 2 * k;
+      double  zr = (z[0] * pr + z[1] * pi) / pm;
+      z[1]       = (z[1] * pr - z[0] * pi) / pm;
+      z[0]       = zr;
+    }
+    for (int r = 0; r < n; r++) {
+      if (r == c)
+        continue;
+      double fr = a[r * 2 * w + 2 * c], fi = a[r * 2 * w + 2 * c + 1];
+      for (int k = 0; k < w; k++) {
+        const double *s = a + c * 2 * w + 2 * k;
+        double       *z = a + r * 2 * w + 2 * k;
+        z[0] -= fr * s[0] - fi * s[1];
+        z[1] -= fr * s[1] + fi * s[0];
+      }
+    }
+  }
+
+  for (int r = 0; ok && r < n; r++) {
+    for (int c = 0; c < n; c++) {
+      X[2 * (c * n + r)]     = a[r * 2 * w + w + 2 * c];
+      X[2 * (c * n + r) + 1] = a[r * 2 * w + w + 2 * c + 1];
+    }
+  }
+  free(a);
+  return ok;
+}
+
+/*
+ * The scattering and impedance matrices of slot `slot` (count x count,
+ * row-major (re, im) pairs; S or Z may be NULL) at the slot centre, which
+ * goes to *freq. S is referred to each port's resistance.
+ */
+bool port_matrix(const PortSet *set, int slot, double *freq, double *S,
+                 double *Z) {
+  int N = set->count;
+
+  if (!set->freq || slot < 0 || slot >= set->bands) {
+    fprintf(stderr, "[port_matrix] no slot %d\n", slot);
+    return false;
+  }
+
+  double  F = 0.5 * (set->freq[slot * N] + set->freq[slot * N + N - 1]);
+  double *V, *I, *A, *Bw;
+  CALLOC(V, double, 2 * (size_t)N * N);
+  CALLOC(I, double, 2 * (size_t)N * N);
+  CALLOC(A, double, 2 * (size_t)N * N);
+  CALLOC(Bw, double, 2 * (size_t)N * N);
+
+  for (int j = 0; j < N; j++) {
+    // Past the first and last sub-band the nearest one is taken as is.
+    int    k0 = slot * N + j;
+    int    k1 = set->freq[k0] < F ? k0 + N : k0 - N;
+    double u  = 0.0;
+
+    if (k1 >= 0 && k1 < set->freqs)
+      u = (F - set->freq[k0]) / (set->freq[k1] - set->freq[k0]);
+    else
+      k1 = k0;
+
+    /*
+     * The drive's phase runs fast with frequency (the pulses are centred
+     * late), so each column is first divided by the driving port's
+     * incident wave; that leaves S and Z unchanged.
+     */
+    double g[2][2];
+    for (int q = 0; q < 2; q++) {
+      int           k = q ? k1 : k0;
+      const double *v = set->v + 2 * ((size_t)j * set->freqs + k);
+      const double *c = set->i + 2 * ((size_t)j * set->freqs + k);
+      double        R = set->port[j].resistance;
+      double        ar = v[0] + R * c[0], ai = v[1] + R * c[1];
+      double        m = ar * ar + ai * ai;
+
+      g[q][0] = m > 0.0 ? ar / m : 0.0;
+      g[q][1] = m > 0.0 ? -ai / m : 0.0;
+    }
+
+    for (int i = 0; i < N; i++) {
+      double R = set->port[i].resistance, s = 2.0 * sqrt(R);
+      size_t e = 2 * ((size_t)i * N + j);
+
+      V[e] = V[e + 1] = I[e] = I[e + 1] = 0.0;
+      for (int q = 0; q < 2; q++) {
+        size_t        k = 2 * ((size_t)i * set->freqs + (q ? k1 : k0));
+        const double *v = set->v + k, *c = set->i + k;
+        double        w = q ? u : 1.0 - u;
+
+        V[e] += w * (v[0] * g[q][0] - v[1] * g[q][1]);
+        V[e + 1] += w * (v[0] * g[q][1] + v[1] * g[q][0]);
+        I[e] += w * (c[0] * g[q][0] - c[1] * g[q][1]);
+        I[e + 1] += w * (c[0] * g[q][1] + c[1] * g[q][0]);
+      }
+      for (int q = 0; q < 2; q++) {
+        A[e + q]  = (V[e + q] + R * I[e + q]) / s;
+        Bw[e + q] = (V[e + q] - R * I[e + q]) / s;
+      }
+    }
+  }
+
+  bool ok = (!S || _cmat_rdiv(N, Bw, A, S)) && (!Z || _cmat_rdiv(N, V, I, Z));
+  if (!ok)
+    fprintf(stderr, "[port_matrix] singular port response at slot %d\n",
+            slot);
+  if (freq)
+    *freq = F;
+
+  free(V);
+  free(I);
+  free(A);
+  free(Bw);
+  return ok;
+}
+
+/*
+ * Frees set and gives the port edges of grid back the coefficients port_add
+ * replaced; call it before grid_free, or with a NULL grid once the grid is
+ * gone.
+ */
+void port_free(Grid *grid, PortSet *set) {
+  for (int j = 0; grid && j < set->count; j++) {
+    const Port *pt    = &set->port[j];
+    Real       *cf[3] = {grid->cexe, grid->ceye, grid->ceze};
+    Real       *cg[3] = {grid->cexh, grid->ceyh, grid->cezh};
+
+    cf[pt->c][pt->offset] = pt->cf;
+    cg[pt->c][pt->offset] = pt->cg;
+  }
+  FREE(set->port);
+  FREE(set->freq);
+  FREE(set->v);
+  FREE(set->i);
+  source_free(&set->source);
+  *set = (PortSet){0};
+}
+
+/*
+ * Adds a thin PEC wire of `radius` cells along the `length` edges of E
+ * component `axis` starting at (m, n, p), edge `gap` of them (-1 for none)
+ * left open for a feed such as a port_add port. The radius must be under
+ * half a cell, where the 1/r model holds; thicker wires are better
+ * voxelized. The wire has to keep one sample clear of the grid edge across
+ * its axis, and is not checked against absorbing layers or symmetry planes.
+ */
+bool wire_add(Grid *grid, int axis, int m, int n, int p, int length,
+              double radius, int gap) {
+  int at[3] = {m, n, p}, N[3];
+
+  if (grid->type != ThreeDimension) {
+    fprintf(stderr, "[wire_add] thin wires are 3D only\n");
+    return false;
+  }
+  if (axis < 0 || axis >= 3 || length < 1 || gap < -1 || gap >= length) {
+    fprintf(stderr, "[wire_add] bad axis, length or gap\n");
+    return false;
+  }
+  if (!(radius > 0.0 && radius < 0.5)) {
+    fprintf(stderr, "[wire_add] radius %g is not below half a cell\n",
+            radius);
+    return false;
+  }
+
+  int b = (axis + 1) % 3, c = (axis + 2) % 3;
+  _component_extent(grid, axis, N);
+  if (at[axis] < 0 || at[axis] + length > N[axis] || at[b] < 1 ||
+      at[b] > N[b] - 2 || at[c] < 1 || at[c] > N[c] - 2) {
+    fprintf(stderr, "[wire_add] wire does not fit the grid\n");
+    return false;
+  }
+
+  Wire wire = {
+      .axis   = axis,
+      .at     = {m, n, p},
+      .length = length,
+      .gap    = gap,
+      .factor = 2.0 / log(1.0 / radius),
+  };
+  int lo[3] = {m - 1, n - 1, p - 1}, hi[3] = {m + 1, n + 1, p + 1};
+  lo[axis]   = at[axis];
+  hi[axis]   = at[axis] + length;
+  wire.reach = (Box3d){lo[0], hi[0], lo[1], hi[1], lo[2], hi[2]};
+
+  grid->wires = realloc(grid->wires, (grid->wire_count + 1) * sizeof(Wire));
+  if (!grid->wires) {
+    fprintf(stderr, "[ERROR] Allocation failed for wires.\n");
+    abort();
+  }
+  grid->wires[grid->wire_count++] = wire;
+  return true;
 }
 
 void snapshotGrid(Grid *grid, Snapshot *snap) {